@@ -0,0 +1,105 @@
+/**
+ * @file icount.c
+ * @author John Izzard
+ * @date 2026-10-16
+ *
+ * @brief Counts the host instructions a sim run spends in the bootloader.
+ */
+
+/**
+ * Copyright (C) 2017-2024 John Izzard
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Usage: icount sim [sim options]
+ *
+ * Runs sim under ptrace (Linux). sim -k traps each time it starts or stops
+ * running bootloader code, and the instructions in between are counted by
+ * single stepping. The rest of the run goes at full speed. The count is
+ * exact and repeatable for a given build, so it's used to compare builds
+ * rather than as a cycle count for the PIC.
+ *
+ * sim's register emulation is called on every register access. It traps once
+ * at the start with the address range of its code (rax = ICOUNT_RANGE, rdi
+ * and rsi the start and end), and steps in that range aren't counted, so an
+ * access costs the bootloader its call instruction.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#define ICOUNT_RANGE 0x1C0 // Also in sim.c.
+
+int main(int argc, char **argv){
+    unsigned long long count = 0;
+    unsigned long skip_start = 0, skip_end = 0, next = 0;
+    int counting = 0;
+    int sig = 0;
+    int status;
+    pid_t pid;
+
+    if(argc < 2){
+        fprintf(stderr, "usage: icount sim [options]\n");
+        return 2;
+    }
+    pid = fork();
+    if(pid == 0){
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        execv(argv[1], argv + 1);
+        _exit(127);
+    }
+    waitpid(pid, &status, 0); // Stopped at exec.
+    while(1){
+        if(ptrace(counting ? PTRACE_SINGLESTEP : PTRACE_CONT, pid, NULL, (void *)(long)sig) < 0) break;
+        sig = 0;
+        if(waitpid(pid, &status, 0) < 0 || WIFEXITED(status) || WIFSIGNALED(status)) break;
+        if(WSTOPSIG(status) == SIGTRAP){
+            siginfo_t info;
+
+            ptrace(PTRACE_GETSIGINFO, pid, NULL, &info);
+            if(info.si_code == SI_KERNEL || info.si_code == SI_TKILL || info.si_code == SI_USER){
+#if defined(__x86_64__)
+                struct user_regs_struct regs;
+
+                ptrace(PTRACE_GETREGS, pid, NULL, &regs);
+                if(regs.rax == ICOUNT_RANGE){
+                    skip_start = regs.rdi;
+                    skip_end = regs.rsi;
+                    continue;
+                }
+#endif
+                counting = !counting;
+            }
+            else if(next < skip_start || next >= skip_end) count++; // Single step.
+#if defined(__x86_64__)
+            if(counting && skip_end) next = ptrace(PTRACE_PEEKUSER, pid, (void *)offsetof(struct user_regs_struct, rip), NULL);
+#endif
+        }
+        else sig = WSTOPSIG(status); // Passed on.
+    }
+    fprintf(stderr, "instructions=%llu\n", count);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
@@ -0,0 +1,10 @@
+/**
+ * @file eeprom.h
+ * @author John Izzard
+ * @date 2026-10-16
+ * 
+ * @brief The sources include "eeprom.h", the file is EEPROM.h. This forwards
+ *        it on case sensitive file systems.
+ */
+
+#include "../../USB_uC.X/EEPROM.h"
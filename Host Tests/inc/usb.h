@@ -0,0 +1,21 @@
+/**
+ * @file usb.h
+ * @author John Izzard
+ * @date 2026-10-16
+ * 
+ * @brief Host stand-in for the USB stack's usb.h, used by the host build.
+ */
+
+#ifndef USB_H
+#define USB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usb_msd.h"
+
+void usb_init(void);
+void usb_tasks(void);
+void usb_ram_set(uint8_t val, uint8_t *ram_addr, uint16_t bytes);
+void usb_rom_copy(const uint8_t *rom_addr, uint8_t *ram_addr, uint16_t bytes);
+
+#endif /* USB_H */
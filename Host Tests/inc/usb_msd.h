@@ -0,0 +1,28 @@
+/**
+ * @file usb_msd.h
+ * @author John Izzard
+ * @date 2026-10-16
+ * 
+ * @brief Host stand-in for the USB stack's usb_msd.h, used by the host build.
+ */
+
+#ifndef USB_MSD_H
+#define USB_MSD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usb_msd_config.h"
+
+typedef struct{
+    uint32_t LBA;
+    uint32_t START_LBA;
+}MSD_RW_10_VARS_t;
+
+extern MSD_RW_10_VARS_t g_msd_rw_10_vars;
+extern uint16_t g_msd_byte_of_sect;
+extern uint8_t g_msd_ep_in[MSD_EP_SIZE];
+extern uint8_t g_msd_ep_out[MSD_EP_SIZE];
+
+void msd_tasks(void);
+
+#endif /* USB_MSD_H */
@@ -0,0 +1,97 @@
+/**
+ * @file xc.h
+ * @author John Izzard
+ * @date 2026-10-16
+ * 
+ * @brief Host stand-in for XC8's xc.h, used by the host build.
+ */
+
+#ifndef XC_H
+#define XC_H
+
+#include <stdint.h>
+
+// XC8 types and qualifiers. uint24_t is wider on the host, but every flash
+// address reaches flash through the 8 bit address registers below, so one
+// that doesn't fit is cut down there as it is on the PIC.
+typedef uint32_t uint24_t;
+typedef int32_t int24_t;
+#define __persistent
+#define __at(x)
+
+// Instructions, carried out by sim.c.
+#define asm(x) sim_asm(x)
+#define __asm(x) sim_asm(x)
+#define NOP() sim_asm("NOP")
+#define ___mkstr(x) #x
+#define __delay_ms(x) ((void)0)
+#define __delay_us(x) ((void)0)
+void sim_asm(const char* s);
+
+// Registers are fields of sim_regs in sim.c, with the same aliasing as the
+// PIC's (PMADR over PMADRL and PMADRH, EECON1bits over EECON1). Every access
+// goes through sim_reg() first, which carries out whatever the accesses
+// before it set going: a read, an erase or write once RD or WR is set, or a
+// step of the EECON2 unlock sequence.
+volatile void *sim_reg(volatile void *reg);
+#define SIM_REG(type, field) (*(volatile type *)sim_reg(&sim_regs.field))
+
+#ifdef _PIC14E
+typedef struct {
+    uint8_t RD:1;
+    uint8_t WR:1;
+    uint8_t WREN:1;
+    uint8_t WRERR:1;
+    uint8_t FREE:1;
+    uint8_t LWLO:1;
+    uint8_t CFGS:1;
+    uint8_t :1;
+} PMCON1bits_t;
+typedef struct {
+    union { uint8_t pmcon1; PMCON1bits_t pmcon1bits; };
+    uint8_t pmcon2;
+    union { uint16_t pmadr; struct { uint8_t pmadrl, pmadrh; }; };
+    union { uint16_t pmdat; struct { uint8_t pmdatl, pmdath; }; };
+} sim_regs_t;
+extern volatile sim_regs_t sim_regs;
+#define PMCON1     SIM_REG(uint8_t, pmcon1)
+#define PMCON1bits SIM_REG(PMCON1bits_t, pmcon1bits)
+#define PMCON2     SIM_REG(uint8_t, pmcon2)
+#define PMADR      SIM_REG(uint16_t, pmadr)
+#define PMADRL     SIM_REG(uint8_t, pmadrl)
+#define PMADRH     SIM_REG(uint8_t, pmadrh)
+#define PMDAT      SIM_REG(uint16_t, pmdat)
+#define PMDATL     SIM_REG(uint8_t, pmdatl)
+#define PMDATH     SIM_REG(uint8_t, pmdath)
+#else
+#define _PIC18
+typedef struct {
+    uint8_t RD:1;
+    uint8_t WR:1;
+    uint8_t WREN:1;
+    uint8_t WRERR:1;
+    uint8_t FREE:1;
+    uint8_t WPROG:1;
+    uint8_t CFGS:1;
+    uint8_t EEPGD:1;
+} EECON1bits_t;
+typedef struct {
+    union { uint8_t eecon1; EECON1bits_t eecon1bits; };
+    uint8_t eecon2, eeadr, eeadrh, eedata, tablat;
+    union { uint32_t tblptr; struct { uint8_t tblptrl, tblptrh, tblptru; }; };
+} sim_regs_t;
+extern volatile sim_regs_t sim_regs;
+#define EECON1     SIM_REG(uint8_t, eecon1)
+#define EECON1bits SIM_REG(EECON1bits_t, eecon1bits)
+#define EECON2     SIM_REG(uint8_t, eecon2)
+#define EEADR      SIM_REG(uint8_t, eeadr)
+#define EEADRH     SIM_REG(uint8_t, eeadrh)
+#define EEDATA     SIM_REG(uint8_t, eedata)
+#define TABLAT     SIM_REG(uint8_t, tablat)
+#define TBLPTR     SIM_REG(uint24_t, tblptr)
+#define TBLPTRL    SIM_REG(uint8_t, tblptrl)
+#define TBLPTRH    SIM_REG(uint8_t, tblptrh)
+#define TBLPTRU    SIM_REG(uint8_t, tblptru)
+#endif
+
+#endif /* XC_H */
@@ -0,0 +1,620 @@
+/**
+ * @file sim.c
+ * @author John Izzard
+ * @date 2026-10-16
+ *
+ * @brief Host build of the bootloader, used by host_test.py and host_bench.py.
+ */
+
+/**
+ * Copyright (C) 2017-2024 John Izzard
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * bootloader.c, flash.c and eeprom.c are built with gcc and linked with this
+ * file, which stands in for the USB MSD library's variables and for the
+ * hardware the libraries drive: the table and PMCON/EECON registers, flash
+ * and data EEPROM. Flash is an array indexed by byte address on every part,
+ * so on PIC16F145X the high byte of each word only keeps 6 bits. The config
+ * space reads back a fixed pattern, saved to config.bin. J parts keep their
+ * config words in the last page of flash.
+ *
+ * Usage: sim [options] [image]
+ *
+ * The image is written with one WRITE_10, a 64 byte packet at a time, then
+ * the host reads LBA 0 again. flash.bin, eeprom.bin and config.bin are saved
+ * at the end and the counters are printed as name=value lines.
+ *
+ * -l lba        LBA the image is written to (default 0x200, free space).
+ * -p seed       Fill user flash with random data first, as if an
+ *               application was there.
+ * -f file       Load flash from a file, such as an earlier flash.bin.
+ * -e file       Load EEPROM from a file.
+ * -2 file@lba   Write a second image in the same session.
+ * -i passes     Run boot_tasks() this many times once the host goes quiet,
+ *               then save flash to idle.bin.
+ * -n            Only run boot_tasks() once before the read, so it comes
+ *               straight after the writes.
+ * -d sectors    Read sectors from LBA 0 into disk.bin.
+ * -a passes     Read the -d sectors this many times, as a host that reads
+ *               the drive again. disk.bin holds the last pass.
+ * -r file       EEPROM workload, address and data byte pairs passed to
+ *               EEPROM_Update(). No image is written.
+ * -g file       Flash workload, records of a byte address (4 bytes, little
+ *               endian), a length (2 bytes) and that many bytes of data, each
+ *               passed to Flash_WriteRange(). No image is written.
+ * -w n          Every n-th block write leaves a byte unprogrammed.
+ * -b addr       A bit at this byte address won't program to 0.
+ * -c n          Cuts the power as the n-th flash erase or write starts:
+ *               flash.bin is saved as it is and the run ends. Prints the
+ *               last erase or write that finished and, with -r, the number
+ *               of EEPROM_Update() calls that returned.
+ * -k w|r        Marks boot_process_write()/boot_tasks() (w) or the
+ *               boot_process_read() calls of -d (r) for icount. Time spent
+ *               in this file is left out.
+ * -t pkt,write,erase[,word]
+ *               Timing model, in microseconds: a 64 byte OUT packet, a block
+ *               write, a row erase and a Flash_WriteWord. Prints the time
+ *               and throughput of the image, or the time of the -g workload.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <xc.h>
+#include "usb.h"
+// bootloader.h and config.h define the volume's constant data, and are
+// included by main.c as they are here. bootloader.c's copy is the one used.
+#pragma weak BOOT16
+#pragma weak ROOT
+#pragma weak aboutFile
+#pragma weak statusFile
+#pragma weak crcFile
+#pragma weak TRISE
+#include "bootloader.h"
+#include "flash.h"
+
+#define SIM_FLASH_SIZE 0x20000
+#define SIM_BOOT_END   0x2000  // Byte address, the bootloader must never touch below it.
+#define SIM_EE_POLLS   4       // EECON1 accesses an EEPROM write lasts for.
+#define ICOUNT_RANGE   0x1C0   // Also in icount.c.
+
+// The hardware emulation, icount doesn't count steps in it.
+#define SIM_HW __attribute__((section("sim_hw")))
+extern const char __start_sim_hw[], __stop_sim_hw[];
+
+#ifdef _PIC14E
+#define ADDR_SCALE 2 // PMADR holds word addresses.
+#define CONFIG_START CONFIG_REGION_START
+#define CONFIG_BYTES 0x40      // Config space, 0x8000 to 0x801F in words.
+#else
+#define ADDR_SCALE 1
+#define CONFIG_START 0x300000  // J parts load these from the last flash page, their config words are read from flash.
+#define CONFIG_BYTES 0x10      // CONFIG1L to CONFIG7H.
+#endif
+#define ERASE_BYTES (_FLASH_ERASE_SIZE * ADDR_SCALE)
+#define WRITE_BYTES (_FLASH_WRITE_SIZE * ADDR_SCALE)
+
+// DEV_ID, only the bits get_device() looks at are right.
+#if defined(_PIC14E)
+#define SIM_DEV_ID 0x3023
+#elif defined(_18F4550)
+#define SIM_DEV_ID 0x1200
+#elif defined(_18F14K50)
+#define SIM_DEV_ID 0x4760
+#else
+#define SIM_DEV_ID 0x5880
+#endif
+
+#if !defined(_PIC14E) && !defined(__J_PART)
+#define SIM_DATA_EEPROM // EEPGD selects flash or data EEPROM. J parts don't have the bit.
+#endif
+
+
+// USB MSD Library
+MSD_RW_10_VARS_t g_msd_rw_10_vars;
+uint16_t g_msd_byte_of_sect;
+uint8_t g_msd_ep_in[MSD_EP_SIZE];
+uint8_t g_msd_ep_out[MSD_EP_SIZE];
+bool user_firmware;
+
+void usb_ram_set(uint8_t val, uint8_t *ram_addr, uint16_t bytes){
+    memset(ram_addr, val, bytes);
+}
+void usb_rom_copy(const uint8_t *rom_addr, uint8_t *ram_addr, uint16_t bytes){
+    memcpy(ram_addr, rom_addr, bytes);
+}
+
+
+// EEPROM Library
+// Only used by the -r workload. Older revisions don't have them.
+void EEPROM_Update(uint8_t address, uint8_t data) __attribute__((weak));
+void EEPROM_ReadBytes(uint8_t address, uint16_t bytes, uint8_t *array) __attribute__((weak));
+
+
+// Flash Library
+// Only used by the -g workload. Older revisions don't have it.
+#ifdef _PIC14E
+void Flash_WriteRange(uint16_t start_addr, uint16_t bytes, uint8_t *flash_array) __attribute__((weak));
+#else
+void Flash_WriteRange(uint24_t start_addr, uint24_t bytes, uint8_t *flash_array) __attribute__((weak));
+#endif
+
+
+// Simulation State
+volatile sim_regs_t sim_regs;
+static uint8_t  m_flash[SIM_FLASH_SIZE];
+static uint8_t  m_config[CONFIG_BYTES];
+static uint8_t  m_eeprom[256];
+static uint8_t  m_file[0x100000];
+static uint8_t  m_holding[WRITE_BYTES]; // TBLWT holding registers, or the PIC16 write latches.
+#ifdef _PIC14E
+static uint8_t  m_latched;     // Latches loaded since the last write.
+#endif
+static uint8_t  m_unlock;      // Steps of the EECON2 unlock seen, 2 once WR may be set.
+static uint8_t  m_ee_busy;     // EECON1 accesses left until a started EEPROM write finishes.
+#ifdef _PIC18
+static uint8_t  m_ee_regs[3];  // EECON1, EEADR and EEDATA as the EEPROM write started.
+#endif
+static long     m_erases, m_writes, m_words, m_reads, m_ee_writes, m_ee_reads, m_ee_polls;
+static long     m_fail_bits;   // Bits a block write was asked to take from 0 back to 1.
+static long     m_weak_every;  // -w
+static long     m_stuck_addr = -1; // -b
+static long     m_cut_at;      // -c
+static long     m_flash_ops;   // Erases and writes started.
+static const char *m_last_op = "none"; // Last erase or write that finished, and its address.
+static uint32_t m_last_addr;
+static long     m_done;        // EEPROM_Update() calls of -r that returned.
+static char     m_count_mode;  // -k
+static bool     m_counting;
+static double   m_t_packet, m_t_write, m_t_erase, m_t_word; // -t
+static double   m_stall;       // Time the core has spent stalled on self-writes.
+
+SIM_HW static void fail(const char *msg, uint32_t addr){
+    printf("fail=%s at 0x%05X\n", msg, addr);
+    exit(1);
+}
+
+SIM_HW static void icount(bool on){
+    // icount single steps between markers, only the bootloader is counted.
+    if(!m_count_mode || on == m_counting) return;
+    m_counting = on;
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ volatile("int3" :: "a"(0));
+#else
+    raise(SIGTRAP);
+#endif
+}
+#define HOST_BEGIN bool counting = m_counting; icount(false);
+#define HOST_END   icount(counting);
+
+
+// Flash
+static void save(const char *path, const uint8_t *buf, size_t size);
+
+SIM_HW static void flash_op(const char *kind, uint32_t addr){
+    // Counts an erase or write as it starts, for -c.
+    if(++m_flash_ops == m_cut_at){
+        save("flash.bin", m_flash, SIM_FLASH_SIZE);
+        printf("cut=%s at 0x%05X\nlast_op=%s\nlast_addr=%u\ndone=%ld\n", kind, addr, m_last_op, m_last_addr, m_done);
+        exit(0);
+    }
+    m_last_op = kind;
+    m_last_addr = addr;
+}
+SIM_HW static uint8_t blank_byte(uint32_t addr){
+    return (ADDR_SCALE == 2 && (addr & 1)) ? 0x3F : 0xFF;
+}
+SIM_HW static uint8_t flash_byte(uint32_t addr){
+    if(m_ee_busy) fail("flash read during an EEPROM write", addr);
+    m_reads++;
+    if(addr >= CONFIG_START && addr < CONFIG_START + CONFIG_BYTES) return m_config[addr - CONFIG_START];
+#ifdef _PIC18
+    if(addr == DEV_ID_START) return (uint8_t)SIM_DEV_ID;
+    if(addr == DEV_ID_START + 1) return (uint8_t)(SIM_DEV_ID >> 8);
+#endif
+    if(addr >= SIM_FLASH_SIZE) return blank_byte(addr);
+    return m_flash[addr] & blank_byte(addr);
+}
+SIM_HW static void flash_erase(uint32_t addr){
+    if(addr % ERASE_BYTES) fail("misaligned erase", addr);
+    if(addr < SIM_BOOT_END) fail("erase in the boot region", addr);
+    flash_op("erase", addr);
+    memset(m_flash + addr, 0xFF, ERASE_BYTES);
+    m_erases++;
+    m_stall += m_t_erase;
+}
+SIM_HW static void flash_write(uint32_t addr, uint8_t bytes){
+    // Programs the holding registers (or latches) from the one addr falls on.
+    // A row write is a block write, anything shorter a word write.
+    uint32_t row = addr & ~(uint32_t)(WRITE_BYTES - 1);
+    uint8_t i = (uint8_t)(addr - row);
+
+    if(addr < SIM_BOOT_END) fail("write in the boot region", addr);
+    flash_op(bytes == WRITE_BYTES ? "write" : "word", addr);
+    if(bytes == WRITE_BYTES){
+        if(i) fail("misaligned write", addr);
+        m_writes++;
+        m_stall += m_t_write;
+    }
+    else{
+        for(i = (uint8_t)(addr - row); i < addr - row + bytes; i++){
+            if((m_flash[row + i] & blank_byte(row + i)) != blank_byte(row + i)) fail("word programmed twice", addr);
+        }
+        i = (uint8_t)(addr - row);
+        m_words++;
+        m_stall += m_t_word;
+    }
+    for(; i < addr - row + bytes; i++){
+        uint8_t data = m_holding[i];
+
+        if((m_flash[row + i] & data) != data) m_fail_bits++;
+        if(bytes == WRITE_BYTES && m_weak_every && (m_writes % m_weak_every) == 0 && i == 5) continue;
+        m_flash[row + i] &= data;
+        if(row + i == m_stuck_addr) m_flash[row + i] |= 1;
+    }
+    for(i = 0; i < WRITE_BYTES; i++) m_holding[i] = blank_byte(i);
+}
+
+
+// Registers
+SIM_HW static bool unlocked(void){
+    // EECON2 (PMCON2) only counts 0x55 then 0xAA on consecutive accesses,
+    // and WR has to be set by the one after. It always reads as 0.
+#ifdef _PIC14E
+    volatile uint8_t *con2 = &sim_regs.pmcon2;
+#else
+    volatile uint8_t *con2 = &sim_regs.eecon2;
+#endif
+    bool ok = (m_unlock == 2);
+
+    if(*con2 == 0x55) m_unlock = 1;
+    else if(*con2 == 0xAA && m_unlock == 1) m_unlock = 2;
+    else m_unlock = 0;
+    *con2 = 0;
+    return ok;
+}
+#ifdef _PIC14E
+SIM_HW static void sim_step(volatile void *reg){
+    volatile sim_regs_t *r = &sim_regs;
+    bool ok = unlocked();
+    uint8_t i;
+
+    (void)reg;
+    r->pmadrh &= 0x7F;
+    if(r->pmcon1bits.RD){
+        uint32_t addr = r->pmcon1bits.CFGS ? CONFIG_REGION_START + (uint32_t)(r->pmadr & 0xFF) * 2 : (uint32_t)r->pmadr * 2;
+
+        r->pmdatl = flash_byte(addr);
+        r->pmdath = flash_byte(addr + 1);
+        r->pmcon1bits.RD = 0;
+    }
+    if(r->pmcon1bits.WR){
+        uint32_t addr = (uint32_t)r->pmadr * 2;
+
+        r->pmcon1bits.WR = 0;
+        if(!ok) fail("WR set without the unlock sequence", addr);
+        if(!r->pmcon1bits.WREN) fail("WR set without WREN", addr);
+        if(r->pmcon1bits.CFGS) fail("config write", addr);
+        if(r->pmcon1bits.FREE){
+            r->pmcon1bits.FREE = 0;
+            flash_erase(addr);
+            return;
+        }
+        // Loads a latch, and with LWLO clear writes the latches loaded so far
+        // to the row PMADR is in. The rest of the row's latches are blank.
+        i = (uint8_t)(addr % WRITE_BYTES);
+        m_holding[i] = r->pmdatl;
+        m_holding[i + 1] = r->pmdath & 0x3F;
+        m_latched++;
+        if(r->pmcon1bits.LWLO) return;
+        if(m_latched == 1) flash_write(addr, 2);
+        else flash_write(addr & ~(uint32_t)(WRITE_BYTES - 1), WRITE_BYTES);
+        m_latched = 0;
+    }
+}
+#else
+SIM_HW static void sim_step(volatile void *reg){
+    volatile sim_regs_t *r = &sim_regs;
+    bool ok = unlocked();
+    uint32_t addr;
+
+    r->tblptr &= 0x3FFFFF; // 22 bits, TBLPTRU bits 6 and 7 read as 0.
+    addr = r->tblptr;
+    if(m_ee_busy){
+        // WREN can be cleared once the write has started, nothing else.
+        if(((r->eecon1 ^ m_ee_regs[0]) & ~0x04) || r->eeadr != m_ee_regs[1] || r->eedata != m_ee_regs[2]){
+            fail("EECON1, EEADR or EEDATA changed during an EEPROM write", r->eeadr);
+        }
+        if(reg == &r->eecon1){
+            m_ee_polls++;
+            if(--m_ee_busy == 0) r->eecon1bits.WR = 0;
+        }
+        return;
+    }
+#ifdef SIM_DATA_EEPROM
+    if(r->eecon1bits.RD){
+        r->eecon1bits.RD = 0;
+        if(!r->eecon1bits.EEPGD && !r->eecon1bits.CFGS){
+            r->eedata = m_eeprom[r->eeadr];
+            m_ee_reads++;
+        }
+    }
+#endif
+    if(r->eecon1bits.WR){
+        if(!ok) fail("WR set without the unlock sequence", addr);
+        if(!r->eecon1bits.WREN) fail("WR set without WREN", addr);
+        if(r->eecon1bits.CFGS) fail("config write", addr);
+#ifdef SIM_DATA_EEPROM
+        if(!r->eecon1bits.EEPGD){
+            m_eeprom[r->eeadr] = r->eedata;
+            m_ee_writes++;
+            m_ee_busy = SIM_EE_POLLS;
+            m_ee_regs[0] = r->eecon1;
+            m_ee_regs[1] = r->eeadr;
+            m_ee_regs[2] = r->eedata;
+            return;
+        }
+#endif
+        r->eecon1bits.WR = 0;
+        if(r->eecon1bits.FREE){
+            r->eecon1bits.FREE = 0;
+            flash_erase(addr);
+        }
+#ifdef __J_PART
+        else if(r->eecon1bits.WPROG) flash_write(addr & ~(uint32_t)1, 2);
+#endif
+        else flash_write(addr & ~(uint32_t)(WRITE_BYTES - 1), WRITE_BYTES); // TBLPTR's low bits pick the holding register, not the block.
+    }
+}
+#endif
+SIM_HW volatile void *sim_reg(volatile void *reg){
+    HOST_BEGIN
+    sim_step(reg);
+    HOST_END
+    return reg;
+}
+
+
+// Instructions
+SIM_HW void sim_asm(const char* s){
+    HOST_BEGIN
+    sim_step(NULL);
+#ifdef _PIC18
+    volatile sim_regs_t *r = &sim_regs;
+
+    if(strstr(s, "PREINC")) r->tblptr = (r->tblptr + 1) & 0x3FFFFF;
+    if(strncmp(s, "TBLRD", 5) == 0) r->tablat = flash_byte(r->tblptr);
+    else if(strncmp(s, "TBLWT", 5) == 0) m_holding[r->tblptr % WRITE_BYTES] = r->tablat;
+    if(strstr(s, "POSTINC")) r->tblptr = (r->tblptr + 1) & 0x3FFFFF;
+    else if(strstr(s, "POSTDEC")) r->tblptr = (r->tblptr - 1) & 0x3FFFFF;
+#else
+    (void)s;
+#endif
+    HOST_END
+}
+
+
+// Host
+static size_t load(const char *path, uint8_t *buf, size_t size){
+    FILE *f = fopen(path, "rb");
+    size_t n;
+
+    if(!f){
+        printf("fail=can't open %s\n", path);
+        exit(2);
+    }
+    n = fread(buf, 1, size, f);
+    fclose(f);
+    if(n == size && buf == m_file){
+        printf("fail=%s is too big\n", path);
+        exit(2);
+    }
+    return n;
+}
+static void save(const char *path, const uint8_t *buf, size_t size){
+    FILE *f = fopen(path, "wb");
+
+    fwrite(buf, 1, size, f);
+    fclose(f);
+}
+static bool run_tasks(void){
+#ifdef HAS_BOOT_TASKS
+    bool busy;
+
+    if(m_count_mode == 'w') icount(true);
+    busy = boot_tasks();
+    icount(false);
+    return busy;
+#else
+    return false;
+#endif
+}
+static double write_image(uint32_t lba, size_t bytes, bool every_pass){
+    // Feeds the image a packet at a time. boot_tasks() runs after a random
+    // choice of packets, or after each one like main() with every_pass. The
+    // timing model starts receiving the next packet once boot_process_write()
+    // has returned the buffer, and boot_tasks() stalls the core while it does.
+    static uint32_t seed = 1;
+    double t_cpu = 0, t_received = m_t_packet;
+    size_t off;
+
+    bytes = (bytes + 511) & ~(size_t)511;
+    g_msd_rw_10_vars.START_LBA = lba;
+    for(off = 0; off < bytes && !g_boot_reset; off += MSD_EP_SIZE){
+        g_msd_rw_10_vars.LBA = lba + (uint32_t)(off / 512);
+        g_msd_byte_of_sect = (uint16_t)(off % 512);
+        memcpy(g_msd_ep_out, m_file + off, MSD_EP_SIZE);
+
+        m_stall = 0;
+        if(m_count_mode == 'w') icount(true);
+        boot_process_write();
+        icount(false);
+        t_cpu = (t_cpu > t_received ? t_cpu : t_received) + m_stall;
+        t_received = t_cpu + m_t_packet;
+
+        seed = seed * 1103515245 + 12345;
+        if(every_pass || (seed & 0x10000)){
+            m_stall = 0;
+            run_tasks();
+            t_cpu += m_stall;
+        }
+    }
+    return t_cpu;
+}
+static double flash_workload(const char *path){
+    size_t n = load(path, m_file, sizeof m_file);
+    size_t i = 0;
+
+    m_stall = 0;
+    while(i + 6 <= n){
+        uint32_t addr = m_file[i] | (m_file[i + 1] << 8) | (m_file[i + 2] << 16) | ((uint32_t)m_file[i + 3] << 24);
+        uint16_t len = (uint16_t)(m_file[i + 4] | (m_file[i + 5] << 8));
+
+        Flash_WriteRange(addr / ADDR_SCALE, len, m_file + i + 6);
+        i += 6 + len;
+    }
+    return m_stall;
+}
+static void eeprom_workload(const char *path){
+#ifdef HAS_EEPROM
+    size_t n = load(path, m_file, sizeof m_file);
+    size_t i;
+
+    for(i = 0; i + 1 < n; i += 2, m_done++) EEPROM_Update(m_file[i], m_file[i + 1]);
+    EEPROM_ReadBytes(0, 256, m_eeprom);
+#else
+    (void)path;
+#endif
+}
+
+int main(int argc, char **argv){
+    uint32_t lba = 0x200, dump = 0;
+    long seed = 0, idle = -1, passes = 1;
+    bool drain = true, timing = false;
+    const char *image = NULL, *second = NULL, *workload = NULL, *ranges = NULL;
+    double t_total = 0;
+    size_t bytes = 0;
+    int opt, i;
+
+    memset(m_eeprom, 0xFF, sizeof m_eeprom);
+    for(i = 0; i < CONFIG_BYTES; i++) m_config[i] = (uint8_t)(0x5A + i * 0x1D) & blank_byte(i);
+#ifdef _PIC14E
+    m_config[DEV_ID_START - CONFIG_START] = (uint8_t)SIM_DEV_ID;
+    m_config[DEV_ID_START - CONFIG_START + 1] = (uint8_t)(SIM_DEV_ID >> 8);
+#endif
+    for(i = 0; i < WRITE_BYTES; i++) m_holding[i] = blank_byte(i);
+    while((opt = getopt(argc, argv, "l:p:f:e:2:i:nd:a:r:g:w:b:c:k:t:")) != -1){
+        switch(opt){
+            case 'l': lba = strtoul(optarg, NULL, 0); break;
+            case 'p': seed = strtol(optarg, NULL, 0); break;
+            case 'f': load(optarg, m_flash, SIM_FLASH_SIZE); user_firmware = true; break;
+            case 'e': load(optarg, m_eeprom, sizeof m_eeprom); break;
+            case '2': second = optarg; break;
+            case 'i': idle = strtol(optarg, NULL, 0); break;
+            case 'n': drain = false; break;
+            case 'd': dump = strtoul(optarg, NULL, 0); break;
+            case 'a': passes = strtol(optarg, NULL, 0); break;
+            case 'r': workload = optarg; break;
+            case 'g': ranges = optarg; break;
+            case 'w': m_weak_every = strtol(optarg, NULL, 0); break;
+            case 'b': m_stuck_addr = strtol(optarg, NULL, 0); break;
+            case 'c': m_cut_at = strtol(optarg, NULL, 0); break;
+            case 'k': m_count_mode = optarg[0]; break;
+            case 't':
+                timing = true;
+                sscanf(optarg, "%lf,%lf,%lf,%lf", &m_t_packet, &m_t_write, &m_t_erase, &m_t_word);
+                break;
+            default: return 2;
+        }
+    }
+    if(optind < argc) image = argv[optind];
+#if defined(__x86_64__)
+    if(m_count_mode) __asm__ volatile("int3" :: "a"(ICOUNT_RANGE), "D"(__start_sim_hw), "S"(__stop_sim_hw));
+#endif
+
+    if(!user_firmware){
+        memset(m_flash, 0xFF, SIM_FLASH_SIZE);
+        if(seed){
+            srand((unsigned)seed);
+            for(i = SIM_BOOT_END; i < SIM_FLASH_SIZE; i++) m_flash[i] = (uint8_t)rand();
+            user_firmware = true;
+        }
+    }
+
+    if(workload) eeprom_workload(workload);
+    else if(ranges) t_total = flash_workload(ranges);
+    else{
+        if(image){
+            bytes = load(image, m_file, sizeof m_file);
+            t_total = write_image(lba, bytes, timing);
+        }
+        if(second && !g_boot_reset){
+            char *at = strrchr(second, '@');
+
+            *at = 0;
+            bytes = load(second, m_file, sizeof m_file);
+            t_total += write_image(strtoul(at + 1, NULL, 0), bytes, timing);
+        }
+        if(idle >= 0){ // Only the main loop runs while the host is quiet.
+            while(idle--) run_tasks();
+            save("idle.bin", m_flash, SIM_FLASH_SIZE);
+        }
+        if(drain){
+            m_stall = 0;
+            while(run_tasks());
+            t_total += m_stall;
+        }
+        else run_tasks();
+        g_msd_rw_10_vars.LBA = 0; // The host's next command.
+        g_msd_byte_of_sect = 0;
+        boot_process_read();
+    }
+
+    while(dump && passes--){
+        FILE *f = fopen("disk.bin", "wb");
+        uint32_t sect;
+        uint16_t off;
+
+        for(sect = 0; sect < dump; sect++){
+            for(off = 0; off < 512; off += MSD_EP_SIZE){
+                g_msd_rw_10_vars.LBA = sect;
+                g_msd_byte_of_sect = off;
+                if(m_count_mode == 'r') icount(true);
+                boot_process_read();
+                icount(false);
+                fwrite(g_msd_ep_in, 1, MSD_EP_SIZE, f);
+            }
+        }
+        fclose(f);
+    }
+
+    save("flash.bin", m_flash, SIM_FLASH_SIZE);
+    save("eeprom.bin", m_eeprom, sizeof m_eeprom);
+    save("config.bin", m_config, CONFIG_BYTES);
+    printf("reset=%d\nerases=%ld\nwrites=%ld\nwords=%ld\nreads=%ld\n", g_boot_reset, m_erases, m_writes, m_words, m_reads);
+    printf("ee_writes=%ld\nee_reads=%ld\nee_polls=%ld\nfail_bits=%ld\n", m_ee_writes, m_ee_reads, m_ee_polls, m_fail_bits);
+    if(timing && bytes) printf("time_us=%.0f\nkbps=%.1f\n", t_total, bytes / t_total * 1e6 / 1024);
+    else if(timing && ranges) printf("time_us=%.0f\n", t_total);
+    return 0;
+}
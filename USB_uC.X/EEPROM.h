@@ -1,7 +1,7 @@
 /**
  * @file eeprom.h
  * @author John Izzard
- * @date 2024-11-12
+ * @date 2026-10-16
  * 
  * @brief EEPROM Library.
  */
@@ -31,6 +31,13 @@
 /**
  * Change Log
  * ----------
+ * File Version 2.1.0 - 2026-10-16
+ * - Added: EEPROM_Update.
+ * - Added: EEPROM_WriteStart and EEPROM_Busy.
+ * - Added: Emulated EEPROM in flash for PIC16F145X and J parts (USE_EMU_EEPROM).
+ * - Added: EEPROM_ReadBytes.
+ * - Added: Include guard.
+ *
  * File Version 2.0.0 - 2024-11-12
  * - Changed: MIT License.
  * - Changed: File name to lower case.
@@ -42,14 +49,66 @@
  * - Added: Initial release of the software.
  */
 
+#ifndef EEPROM_H
+#define EEPROM_H
+
 #include <stdint.h>
 
 #ifdef _18F46K80
 void    EEPROM_Write(uint16_t address, uint8_t data);
 uint8_t EEPROM_Read(uint16_t address);
+void    EEPROM_ReadBytes(uint16_t address, uint16_t bytes, uint8_t *array);
+void    EEPROM_Update(uint16_t address, uint8_t data);
+void    EEPROM_WriteStart(uint16_t address, uint8_t data);
+uint8_t EEPROM_Busy(void);
 #endif
 
 #if defined(_18F4550_FAMILY_) || defined(_18F24K50) || defined(_18F25K50) || defined(_18F45K50) || defined(_18F14K50)
 void    EEPROM_Write(uint8_t address, uint8_t data);
 uint8_t EEPROM_Read(uint8_t address);
-#endif
\ No newline at end of file
+void    EEPROM_ReadBytes(uint8_t address, uint16_t bytes, uint8_t *array);
+void    EEPROM_Update(uint8_t address, uint8_t data);
+void    EEPROM_WriteStart(uint8_t address, uint8_t data);
+uint8_t EEPROM_Busy(void);
+#endif
+
+// Emulated EEPROM for parts without data EEPROM. Writes are logged to one of
+// two flash pages (in flash library addresses), the other page is erased and
+// the log compacted into it when it fills.
+//#define USE_EMU_EEPROM // Uncomment to emulate EEPROM.BIN in flash on parts without EEPROM (HEF on PIC16F145X, two pages under the config page on J parts).
+
+#ifdef SIMPLE_BOOTLOADER // No EEPROM.BIN file.
+#undef USE_EMU_EEPROM
+#endif
+
+#if !defined(USE_EMU_EEPROM)
+#elif defined(_PIC14E) // High-Endurance Flash rows.
+#define EMU_EEPROM_START 0x1F80
+#define EMU_PAGE_SIZE    (_FLASH_ERASE_SIZE * 2)
+#define EMU_EEPROM_SIZE  32
+#elif defined(_18F24J50) || defined(_18F44J50) // Two pages under the config page.
+#define EMU_EEPROM_START 0x03400
+#elif defined(_18F25J50) || defined(_18F45J50)
+#define EMU_EEPROM_START 0x07400
+#elif defined(_18F26J50) || defined(_18F46J50) || defined(_18F26J53) || defined(_18F46J53)
+#define EMU_EEPROM_START 0x0F400
+#elif defined(_18F27J53) || defined(_18F47J53)
+#define EMU_EEPROM_START 0x1F400
+#elif defined(_18F2450) || defined(_18F4450) // Neither EEPROM nor flash set aside for it.
+#error "USE_EMU_EEPROM isn't supported on this part."
+#else // Parts with data EEPROM use it.
+#undef USE_EMU_EEPROM
+#endif
+#if defined(USE_EMU_EEPROM) && defined(__J_PART)
+#define EMU_PAGE_SIZE    _FLASH_ERASE_SIZE
+#define EMU_EEPROM_SIZE  256
+#endif
+
+#ifdef EMU_EEPROM_START
+void    EEPROM_Write(uint8_t address, uint8_t data);
+uint8_t EEPROM_Read(uint8_t address);
+void    EEPROM_ReadBytes(uint8_t address, uint16_t bytes, uint8_t *array);
+void    EEPROM_Update(uint8_t address, uint8_t data);
+#endif
+
+#endif /* EEPROM_H */
\ No newline at end of file
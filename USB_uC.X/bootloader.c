@@ -1,7 +1,7 @@
 /**
  * @file bootloader.c
  * @author John Izzard
- * @date 2024-11-12
+ * @date 2026-10-16
  * 
  * @brief USB uC - USB MSD Bootloader.
  */
@@ -31,6 +31,31 @@
 /**
  * Change Log
  * ----------
+ * File Version 4.1.0 - 2026-10-16
+ * - Changed: HEX parser works on a whole endpoint buffer at a time, decoding
+ *            data straight into m_flash_block.
+ * - Added: Support for HEX records longer than 16 bytes.
+ * - Added: UF2 image support (USE_UF2).
+ * - Added: Writable PROG_MEM.BIN (USE_BIN_WRITE).
+ * - Added: Compressed image support (USE_UCLZ).
+ * - Added: Delta patch support (USE_DELTA), patches for other firmware are counted in STATUS.TXT.
+ * - Added: Erase on demand (USE_ERASE_ON_DEMAND, FULL_WIPE).
+ * - Added: Skip unchanged rows (USE_SKIP_SAME) and STATUS.TXT.
+ * - Added: Skip blank blocks (USE_SKIP_BLANK).
+ * - Added: Block cache for out of order records (USE_BLOCK_CACHE).
+ * - Added: Double buffered block writes (USE_DOUBLE_BUFFER, boot_tasks()).
+ * - Added: Blank rows aren't erased (USE_ERASE_CHECK).
+ * - Added: Write verify with retries (USE_VERIFY), counts in STATUS.TXT.
+ * - Changed: EEPROM bytes are only written if they differ.
+ * - Added: EEPROM writes from the main loop (USE_EEPROM_QUEUE).
+ * - Added: EEPROM.BIN on parts without EEPROM, emulated in flash (USE_EMU_EEPROM).
+ * - Changed: EEPROM data in images is written as it arrives, not through m_flash_block.
+ * - Changed: EEPROM.BIN is read with EEPROM_ReadBytes, or from RAM (USE_EEPROM_MIRROR).
+ * - Added: PROG_MEM.BIN sized to the programmed part of flash (USE_TRIM_PROG_MEM).
+ * - Added: PROG_MEM.HEX, rendered from flash as it's read (USE_PROG_MEM_HEX).
+ * - Added: PROG_MEM.CRC, CRC-32s worked out the first time it's read (USE_PROG_MEM_CRC).
+ * - Added: FAT12 FAT for the fast mount volume (USE_FAST_MOUNT).
+ *
  * File Version 4.0.1 - 2024-11-12
  * - Changed: MIT License.
  *
@@ -61,15 +86,39 @@
 #include "eeprom.h"
 
 #if defined(_PIC14E)
-// _FLASH_WRITE_SIZE is in words (14bits), double to be in bytes.
+// _FLASH_WRITE_SIZE and _FLASH_ERASE_SIZE are in words (14bits), double to be in bytes.
 #define FLASH_WRITE_SIZE (_FLASH_WRITE_SIZE * 2)
+#define FLASH_ERASE_SIZE (_FLASH_ERASE_SIZE * 2)
 #else
 #define FLASH_WRITE_SIZE  _FLASH_WRITE_SIZE
+#define FLASH_ERASE_SIZE  _FLASH_ERASE_SIZE
 #endif
 
 #define INDEX_MASK (((uint24_t)FLASH_WRITE_SIZE) - 1)
 #define FLASH_ADDR_MASK ~INDEX_MASK
 
+#define ROW_INDEX_MASK (((uint24_t)FLASH_ERASE_SIZE) - 1)
+#define ROW_ADDR_MASK  ~ROW_INDEX_MASK
+
+#ifdef USE_ERASE_CHECK
+#define ERASE_ROWS Flash_EraseUsed // Skips rows that are already blank.
+#else
+#define ERASE_ROWS Flash_Erase
+#endif
+
+#ifdef USE_TRIM_PROG_MEM
+#define PROG_MEM_SIZE prog_mem_size()
+#else
+#define PROG_MEM_SIZE FILE_SIZE
+#endif
+#define PROG_MEM_CLUSTERS ((uint16_t)((PROG_MEM_SIZE + CLUSTER_SIZE - 1) / CLUSTER_SIZE))
+
+#ifdef USE_TRIM_PROG_MEM
+#define HEX_PROG_SIZE PROG_MEM_SIZE
+#else
+#define HEX_PROG_SIZE (PROG_REGION_END - PROG_REGION_START) // J config words get their own records.
+#endif
+
 /* ************************************************************************** */
 /* ************************** GLOBAL VARIABLES ****************************** */
 /* ************************************************************************** */
@@ -89,24 +138,208 @@ extern bool user_firmware;
 static void     generate_boot(void);
 static void     generate_FAT(void);
 static void     generate_root(void);
+#ifdef HAS_STATUS_FILE
+static void     generate_status(void);
+static void     reset_status(void);
+static void     put_dec(uint8_t pos, uint16_t value);
+#endif
+#ifdef USE_PROG_MEM_CRC
+static void     generate_crc(void);
+static void     put_hex32(uint8_t pos, uint32_t value);
+#endif
+#if defined(USE_PROG_MEM_HEX) || defined(USE_PROG_MEM_CRC)
+static void     read_config_words(uint8_t *p_data);
+#endif
+#ifdef USE_PROG_MEM_HEX
+static void     generate_hex(void);
+static bool     hex_segment(uint8_t seg, uint24_t *p_addr, uint24_t *p_size);
+static uint24_t hex_segment_chars(uint24_t size);
+static uint24_t hex_file_size(void);
+static void     hex_read(uint24_t address, uint8_t bytes, uint8_t *p_data);
+static void     hex_put_record(uint8_t type, uint16_t address, uint8_t bytes, uint8_t *p_data);
+static void     hex_put_byte(uint8_t value);
+static void     hex_put_char(uint8_t c);
+#endif
 
-static uint8_t  hex_parse(uint8_t chr);
-static bool     hex_char_to_char(uint8_t* chr);
+static uint8_t  start_image(void);
+static uint8_t  hex_parse(void);
+#ifdef USE_UF2
+static uint8_t  uf2_target(uint32_t address, uint32_t size);
+static uint8_t  uf2_parse(void);
+#endif
+#ifdef USE_UCLZ
+static uint8_t  lz_parse(void);
+static bool     lz_copy(uint16_t dist, uint8_t len);
+static bool     read_image_byte(uint24_t address, uint8_t* p_data);
+#endif
 
-static bool     update_erase_block(uint24_t address, uint8_t* data, uint8_t cnt);
+static bool     update_erase_block(uint24_t address);
+static bool     insert_block_byte(uint8_t data);
+static bool     flush_blocks(void);
+#ifdef USE_BLOCK_CACHE
+static bool     switch_block(uint24_t flash_addr, bool full);
+#endif
+#ifndef SIMPLE_BOOTLOADER
 static uint32_t LBA_to_flash_addr (uint32_t LBA);
+#endif
+#ifdef USE_TRIM_PROG_MEM
+static uint24_t prog_mem_size(void);
+#endif
 static void     delete_file(void);
 static bool     safely_write_block(uint24_t start_addr);
+#ifndef USE_SKIP_SAME // Blocks go through the row buffer instead.
+static void     write_block(uint24_t start_addr, uint8_t* p_block);
+#endif
+#if defined(USE_ROW_RMW) && (defined(USE_SKIP_SAME) || defined(USE_VERIFY))
+static bool     flash_matches(uint24_t address, uint8_t* p_data, uint16_t size);
+#endif
+#if defined(USE_VERIFY) && !defined(USE_SKIP_SAME)
+static bool     flash_programmed(uint24_t address, uint8_t* p_block, uint16_t size);
+#endif
+#ifdef USE_DOUBLE_BUFFER
+static void     queue_block(uint24_t flash_addr);
+static void     commit_block(void);
+#endif
+#ifdef HAS_EEPROM
+static void     eeprom_write(uint8_t address, uint8_t data);
+#endif
+#if defined(HAS_EEPROM) && !defined(SIMPLE_BOOTLOADER)
+static void     eeprom_read_bytes(uint8_t address, uint8_t bytes, uint8_t *p_data);
+#endif
+#ifdef USE_EEPROM_MIRROR
+static void     eeprom_load_mirror(void);
+#endif
+#ifdef USE_EEPROM_QUEUE
+static void     eeprom_queue(uint8_t address, uint8_t data);
+#if !defined(USE_EEPROM_MIRROR) && !defined(SIMPLE_BOOTLOADER) // For EEPROM.BIN reads.
+static uint8_t  eeprom_read(uint8_t address);
+#endif
+static bool     eeprom_service(void);
+static void     eeprom_flush(void);
+#endif
+#if defined(USE_ERASE_ON_DEMAND) && (!defined(USE_SKIP_SAME) || defined(FULL_WIPE)) // USE_SKIP_SAME erases rows in commit_row().
+static void     erase_on_demand(uint24_t address);
+#endif
+
+#ifdef USE_BIN_WRITE
+static void     bin_write(void);
+#endif
+#ifdef USE_DELTA
+static uint8_t  delta_parse(void);
+#endif
+#if defined(USE_DELTA) || defined(USE_PROG_MEM_CRC)
+static uint32_t flash_crc32(uint8_t *p_buffer);
+static uint32_t crc32_update(uint32_t crc, uint8_t *p_data, uint8_t bytes);
+#endif
+#ifdef USE_ROW_RMW
+static void     open_row(uint24_t address, bool blank);
+#if defined(USE_BIN_WRITE) || defined(USE_DELTA)
+static void     row_write_byte(uint24_t address, uint8_t data);
+#endif
+static void     commit_row(void);
+#endif
+#ifdef USE_SKIP_SAME
+static void     row_write_block(uint24_t address);
+#endif
 
+#if !defined(_18F14K50) && !defined(_18F24K50) // The volume label doesn't name a variant.
 static uint8_t  get_device(void);
+#endif
 
 /* ************************************************************************** */
 /* ************************** STATIC VARIABLES ****************************** */
 /* ************************************************************************** */
 
 static uint8_t  m_flash_block[FLASH_WRITE_SIZE];
-static uint24_t m_prev_flash_addr = PROG_REGION_START;
-static uint8_t  m_prev_block_index = 0;
+static uint24_t m_block_addr = PROG_REGION_START;
+static uint8_t  m_block_index = 0;
+#ifdef USE_SKIP_BLANK
+static uint8_t  m_block_and = 0xFF; // AND of the bytes in m_flash_block, 0xFF if blank.
+#endif
+#ifdef EEPROM_REGION_START
+static bool     m_ee_record = false; // Data is for EEPROM, it's written as it arrives instead of going through m_flash_block.
+static uint16_t m_ee_index;          // EEPROM address of the next byte.
+#endif
+
+#ifdef USE_BLOCK_CACHE
+static bool     m_block_used = false; // m_flash_block holds data not yet written or cached.
+static uint8_t  m_cache[BLOCK_CACHE_SLOTS][FLASH_WRITE_SIZE];
+static uint24_t m_cache_addr[BLOCK_CACHE_SLOTS];
+static uint16_t m_cache_age[BLOCK_CACHE_SLOTS]; // 0 if the slot is free.
+static uint16_t m_cache_tick = 0;
+#ifdef USE_SKIP_BLANK
+static uint8_t  m_cache_and[BLOCK_CACHE_SLOTS];
+#endif
+#endif
+
+#ifdef USE_DOUBLE_BUFFER
+static uint8_t  m_commit_block[FLASH_WRITE_SIZE]; // Full block waiting for commit_block() to write it.
+static uint24_t m_commit_addr;
+static bool     m_commit_pending = false;
+#endif
+
+#ifdef USE_EEPROM_MIRROR
+static uint8_t  m_ee_mirror[EEPROM_SIZE]; // EEPROM as it is, or will be once the queue is written.
+static bool     m_ee_mirror_valid = false;
+#endif
+
+#ifdef USE_EEPROM_QUEUE
+static uint8_t  m_ee_buf[EEPROM_SIZE];       // Bytes waiting to be written to EEPROM.
+static uint8_t  m_ee_dirty[EEPROM_SIZE / 8]; // One bit per byte of m_ee_buf.
+static uint16_t m_ee_pending = 0;            // Dirty bytes left.
+static uint8_t  m_ee_next = 0;               // Where eeprom_service() looks next.
+#endif
+
+#ifdef USE_ERASE_ON_DEMAND
+static uint8_t  m_erased[((PROG_REGION_END - PROG_REGION_START) / FLASH_ERASE_SIZE + 7) / 8]; // One bit per erase row.
+#endif
+
+#ifdef USE_FAST_MOUNT
+static uint8_t  m_fat_packet = 0;  // Packet of the FAT m_fat_cluster and m_fat_pos are for.
+static uint16_t m_fat_cluster = 0; // First cluster of the pair that packet starts in.
+static uint8_t  m_fat_pos = 0;     // Byte of the pair it starts at.
+#endif
+
+#ifdef USE_UCLZ
+static uint24_t m_lz_seg_start = PROG_REGION_START;
+#endif
+
+#ifdef USE_ROW_RMW
+static uint8_t  m_row[FLASH_ERASE_SIZE]; // Read-modify-write copy of one erase row.
+static uint24_t m_row_addr;
+static bool     m_row_open = false;
+static bool     m_row_dirty;
+#endif
+
+#ifdef USE_SKIP_SAME
+static bool     m_row_fresh; // Row was built from blank, compare it with flash on commit.
+#endif
+#ifdef USE_BIN_WRITE
+static uint16_t m_row_idle = 0; // boot_tasks() calls since the last write.
+#endif
+
+#ifdef HAS_STATUS_FILE
+static __persistent STATUS_t m_status; // Survives the reset after programming, but not the application running (see STATUS_t).
+#endif
+
+#ifdef USE_VERIFY
+static bool     m_write_failed; // Flash didn't match after VERIFY_RETRIES retries.
+#endif
+
+#ifdef USE_PROG_MEM_CRC
+static bool     m_crc_valid = false; // Cleared by any write, the CRCs are worked out again on the next read.
+static uint32_t m_crc_flash;
+static uint32_t m_crc_length;
+#ifdef HAS_EEPROM
+static uint32_t m_crc_eeprom;
+#endif
+static uint32_t m_crc_config;
+#endif
+
+#ifdef USE_PROG_MEM_HEX
+static int8_t   m_hex_pos; // Where the next PROG_MEM.HEX character goes, relative to g_msd_ep_in.
+static uint8_t  m_hex_sum; // Checksum of the record being rendered.
+#endif
 
 /* ************************************************************************** */
 /* ************************** GLOBAL FUNCTIONS ****************************** */
@@ -114,10 +347,23 @@ static uint8_t  m_prev_block_index = 0;
 
 void boot_process_read(void)
 {
+    #ifdef USE_EEPROM_QUEUE
+    while(EEPROM_Busy()){} // Flash reads and get_device() change EECON1, boot_tasks() may have left a write running.
+    #endif
+    #ifdef USE_DOUBLE_BUFFER
+    commit_block(); // Reads must see what was written to flash.
+    #endif
+    #ifdef USE_ROW_RMW
+    commit_row(); // Reads must see what was written to flash.
+    #endif
     usb_ram_set(0, g_msd_ep_in, MSD_EP_SIZE); // Blank Regions of memory are read as zero.
     
     if(g_msd_rw_10_vars.LBA == BOOT_SECT_ADDR)      generate_boot(); // If PC is reading the Boot Sector.
+    #ifdef USE_PROG_MEM_HEX
+    else if(g_msd_rw_10_vars.LBA < ROOT_SECT_ADDR)  generate_FAT();  // PROG_MEM.HEX's chain goes past the first FAT Sector.
+    #else
     else if(g_msd_rw_10_vars.LBA == FAT_SECT_ADDR)  generate_FAT();  // If PC is reading the first FAT Sector.
+    #endif
     else if(g_msd_rw_10_vars.LBA == ROOT_SECT_ADDR) generate_root(); // If PC is reading the Root Sector.
     #ifndef SIMPLE_BOOTLOADER
     else if(g_msd_rw_10_vars.LBA >= DATA_SECT_ADDR) // If PC is reading the Data Sector.
@@ -128,12 +374,21 @@ void boot_process_read(void)
             else if(g_msd_byte_of_sect == 64) usb_rom_copy((aboutFile + 64), g_msd_ep_in, sizeof(aboutFile)-64);
         }
         #if defined(HAS_EEPROM)
-        else if(g_msd_rw_10_vars.LBA == EEPROM_SECT_ADDR)
+        else if(g_msd_rw_10_vars.LBA == EEPROM_SECT_ADDR) eeprom_read_bytes((uint8_t)g_msd_byte_of_sect, MSD_EP_SIZE, g_msd_ep_in);
+        #endif
+        #ifdef HAS_STATUS_FILE
+        else if(g_msd_rw_10_vars.LBA == STATUS_SECT_ADDR) generate_status();
+        #endif
+        #ifdef USE_PROG_MEM_CRC
+        else if(g_msd_rw_10_vars.LBA == CRC_SECT_ADDR) generate_crc();
+        #endif
+        #ifdef USE_PROG_MEM_HEX
+        else if(g_msd_rw_10_vars.LBA >= HEX_SECT_ADDR) // If PC is reading PROG_MEM.HEX.
         {
-            for(uint8_t i = 0; i < MSD_EP_SIZE; i++) g_msd_ep_in[i] = EEPROM_Read((uint8_t)g_msd_byte_of_sect + i);
+            if(user_firmware) generate_hex();
         }
         #endif
-        else
+        else if(g_msd_rw_10_vars.LBA >= PROG_MEM_SECT_ADDR && g_msd_rw_10_vars.LBA < (PROG_MEM_SECT_ADDR + FILE_SECTORS))
         {
             // Convert from LBA address space to flash address space.
             uint24_t addr = (uint24_t)LBA_to_flash_addr(g_msd_rw_10_vars.LBA);
@@ -154,7 +409,29 @@ void boot_process_read(void)
 void boot_process_write(void)
 {
     static uint8_t boot_state = BOOT_DUMMY;
+    #if !defined(SIMPLE_BOOTLOADER) && defined(HAS_EEPROM)
     uint16_t i;
+    #endif
+    
+    #ifdef USE_EEPROM_QUEUE
+    while(EEPROM_Busy()){} // As in boot_process_read().
+    #endif
+    #ifdef USE_PROG_MEM_CRC
+    m_crc_valid = false; // EEPROM.BIN writes don't reset, PROG_MEM.CRC has to see them.
+    #endif
+    
+    #ifdef USE_BIN_WRITE
+    m_row_idle = 0;
+    if(boot_state == BOOT_DUMMY)
+    {
+        if(user_firmware && g_msd_rw_10_vars.LBA >= PROG_MEM_SECT_ADDR && g_msd_rw_10_vars.LBA < (PROG_MEM_SECT_ADDR + FILE_SECTORS))
+        {
+            bin_write(); // Host is overwriting PROG_MEM.BIN in place.
+            return;
+        }
+        commit_row(); // Any other write finishes a PROG_MEM.BIN write.
+    }
+    #endif
     
     if(boot_state == BOOT_DUMMY)
     {
@@ -162,23 +439,13 @@ void boot_process_write(void)
         if(g_msd_rw_10_vars.LBA == g_msd_rw_10_vars.START_LBA && g_msd_rw_10_vars.LBA >= DATA_SECT_ADDR)
         {
             #if defined(SIMPLE_BOOTLOADER) || !defined(HAS_EEPROM)
-            if(g_msd_byte_of_sect == 0 && g_msd_ep_out[0] == ':') // First byte of HEX file is ':'.
-            { 
-                if(user_firmware) delete_file();
-                usb_ram_set(0xFF, m_flash_block, sizeof(m_flash_block));
-                boot_state = BOOT_LOAD_HEX;
-            }
+            if(g_msd_byte_of_sect == 0) boot_state = start_image();
             #else
             if(g_msd_rw_10_vars.LBA == EEPROM_SECT_ADDR && g_msd_byte_of_sect < EEPROM_SIZE)
             {
-                for(i = 0; i < MSD_EP_SIZE; i++) EEPROM_Write((uint8_t)(g_msd_byte_of_sect + i), g_msd_ep_out[i]);
-            }
-            else if(g_msd_byte_of_sect == 0 && g_msd_ep_out[0] == ':') // First byte of HEX file is ':'.
-            { 
-                if(user_firmware) delete_file();
-                usb_ram_set(0xFF, m_flash_block, sizeof(m_flash_block));
-                boot_state = BOOT_LOAD_HEX;
+                for(i = 0; i < MSD_EP_SIZE; i++) eeprom_write((uint8_t)(g_msd_byte_of_sect + i), g_msd_ep_out[i]);
             }
+            else if(g_msd_byte_of_sect == 0) boot_state = start_image();
             #endif
         }
         #ifndef SIMPLE_BOOTLOADER
@@ -197,7 +464,7 @@ void boot_process_write(void)
             #ifdef HAS_EEPROM
             if(g_msd_ep_out[0] == 0x00 || g_msd_ep_out[0] == 0xE5)
             {
-                for(i = 0; i < EEPROM_SIZE; i++) EEPROM_Write((uint8_t)i, 0xFF);
+                for(i = 0; i < EEPROM_SIZE; i++) eeprom_write((uint8_t)i, 0xFF);
                 g_boot_reset = true;
             }
             #endif
@@ -205,24 +472,84 @@ void boot_process_write(void)
         #endif
     }
     
-    if(boot_state == BOOT_LOAD_HEX && g_msd_rw_10_vars.LBA >= DATA_SECT_ADDR)
+    if(boot_state != BOOT_DUMMY && boot_state != BOOT_FINISHED && g_msd_rw_10_vars.LBA >= DATA_SECT_ADDR)
     {
         uint8_t hex_result;
         
-        for(i = 0; i < MSD_EP_SIZE; i++)
+        #ifdef USE_UF2
+        if(boot_state == BOOT_LOAD_UF2) hex_result = uf2_parse();
+        else
+        #endif
+        #ifdef USE_UCLZ
+        if(boot_state == BOOT_LOAD_LZ) hex_result = lz_parse();
+        else
+        #endif
+        #ifdef USE_DELTA
+        if(boot_state == BOOT_LOAD_DELTA) hex_result = delta_parse();
+        else
+        #endif
+        hex_result = hex_parse();
+        
+        if(hex_result != HEX_PARSING)
         {
-            hex_result = hex_parse(g_msd_ep_out[i]);
-            if(hex_result != HEX_PARSING)
+            #ifdef USE_DOUBLE_BUFFER
+            if(hex_result != HEX_FAULT) commit_block(); // Last block goes in before the image is reported done, a failed image drops it.
+            #endif
+            #ifdef USE_VERIFY
+            if(m_write_failed) hex_result = HEX_FAULT;
+            #endif
+            if(hex_result == HEX_FAULT) delete_file();
+            #if defined(USE_ROW_RMW) || defined(FULL_WIPE)
+            else
             {
-                if(hex_result == HEX_FAULT) delete_file();
-                boot_state = BOOT_FINISHED;
-                g_boot_reset = true;
-                break;
+                #ifdef USE_ROW_RMW
+                commit_row(); // Last row is still in RAM.
+                #ifdef USE_VERIFY
+                if(m_write_failed) delete_file(); // Don't leave an image that didn't verify.
+                #endif
+                #endif
+                #ifdef FULL_WIPE
+                if(boot_state != BOOT_LOAD_DELTA) // Delta patches keep the rows they don't change.
+                {
+                    uint24_t addr;
+                    for(addr = PROG_REGION_START; addr < PROG_REGION_END; addr += FLASH_ERASE_SIZE) erase_on_demand(addr);
+                }
+                #endif
             }
+            #endif
+            boot_state = BOOT_FINISHED;
+            g_boot_reset = true;
         }
     }
 }
 
+#ifdef HAS_BOOT_TASKS
+bool boot_tasks(void)
+{
+    // Called from the main loop, for work that would otherwise hold up USB.
+    // Returns true while there's still some waiting.
+    bool busy = false;
+    
+    #ifdef USE_DOUBLE_BUFFER
+    commit_block();
+    #endif
+    #ifdef USE_BIN_WRITE
+    // The last row of a PROG_MEM.BIN write is only written once the row is
+    // complete, or by the next command. If the host goes quiet instead, it's
+    // written here.
+    if(m_row_open)
+    {
+        if(++m_row_idle >= BIN_IDLE_TASKS) commit_row();
+        else busy = true;
+    }
+    #endif
+    #ifdef USE_EEPROM_QUEUE
+    if(eeprom_service()) busy = true;
+    #endif
+    return busy;
+}
+#endif
+
 /* ************************************************************************** */
 /* ************************** STATIC FUNCTIONS ****************************** */
 /* ************************************************************************** */
@@ -239,8 +566,8 @@ static void generate_boot(void)
 
 static void generate_FAT(void)
 {
-    // The following code assumes FAT16 is used and all files can fit inside
-    // the first 512 bytes of FAT.
+    // The following code assumes FAT16 is used (FAT12 with USE_FAST_MOUNT) and
+    // all files can fit inside the first 512 bytes of FAT.
     
     #ifdef SIMPLE_BOOTLOADER // Simple bootloader only contains reserved FAT entries.
     if(g_msd_byte_of_sect == 0)
@@ -248,14 +575,89 @@ static void generate_FAT(void)
         g_msd_ep_in[0] = 0xF8;
         g_msd_ep_in[1] = 0xFF;
         g_msd_ep_in[2] = 0xFF;
+        #ifndef USE_FAST_MOUNT // FAT12 reserved entries are 3 bytes.
         g_msd_ep_in[3] = 0xFF;
+        #endif
     }
     
     #else // Non-simple bootloader contains files such as ABOUT, EEPROM and PROG_MEM. FAT needs to be generated (more compact).
     uint16_t FAT_cluster;
+    #ifndef USE_FAST_MOUNT
     uint16_t *p_FAT_entry = (uint16_t*)g_msd_ep_in;
+    #endif
+    #if ((PROG_MEM_CLUST + FILE_CLUSTERS) * 2) > MSD_EP_SIZE || defined(USE_PROG_MEM_HEX) || defined(USE_FAST_MOUNT)
+    uint16_t last_cluster;
+    #endif
+    #ifdef USE_PROG_MEM_HEX
+    uint16_t hex_last_cluster;
+    #endif
+    
+    #ifdef USE_FAST_MOUNT // FAT12, each pair of entries is packed into 3 bytes.
+    uint16_t FAT_entry[2];
+    uint8_t  packed[3];
+    uint8_t  packet = (uint8_t)(((uint8_t)(g_msd_rw_10_vars.LBA - FAT_SECT_ADDR) * (512 / MSD_EP_SIZE)) + (g_msd_byte_of_sect / MSD_EP_SIZE));
+    uint8_t  pos;
+    uint8_t  i = 0;
+    
+    // Packets start part way through a pair. Hosts read the FAT in order, so
+    // the pair is found by stepping on from the last packet, not dividing by 3.
+    if(packet < m_fat_packet)
+    {
+        m_fat_packet  = 0;
+        m_fat_cluster = 0;
+        m_fat_pos     = 0;
+    }
+    while(m_fat_packet < packet)
+    {
+        m_fat_packet++;
+        m_fat_cluster += (MSD_EP_SIZE / 3) * 2; // Whole pairs in a packet,
+        m_fat_pos     += MSD_EP_SIZE % 3;       // then the bytes left over.
+        if(m_fat_pos >= 3)
+        {
+            m_fat_pos     -= 3;
+            m_fat_cluster += 2;
+        }
+    }
+    FAT_cluster = m_fat_cluster;
+    pos = m_fat_pos;
+    
+    // Packets past the last file are left as zeros.
+    if(!user_firmware && FAT_cluster >= PROG_MEM_CLUST) return;
+    last_cluster = PROG_MEM_CLUST + PROG_MEM_CLUSTERS - 1;
+    #ifdef USE_PROG_MEM_HEX
+    hex_last_cluster = HEX_CLUST + (uint16_t)((hex_file_size() + CLUSTER_SIZE - 1) / CLUSTER_SIZE) - 1;
+    if(FAT_cluster > hex_last_cluster) return;
+    #else
+    if(FAT_cluster > last_cluster) return;
+    #endif
+    
+    while(i < MSD_EP_SIZE)
+    {
+        for(uint8_t j = 0; j < 2; j++, FAT_cluster++)
+        {
+            // Media type, then the reserved entry and the single cluster files.
+            if(FAT_cluster < PROG_MEM_CLUST) FAT_entry[j] = (FAT_cluster == 0) ? 0xFF8 : 0xFFF;
+            // Each cluster of a file points to the next, the last is EOF.
+            else if(user_firmware && FAT_cluster <= last_cluster)
+            {
+                FAT_entry[j] = (FAT_cluster == last_cluster) ? 0xFFF : FAT_cluster + 1;
+            }
+            #ifdef USE_PROG_MEM_HEX
+            else if(user_firmware && FAT_cluster >= HEX_CLUST && FAT_cluster <= hex_last_cluster)
+            {
+                FAT_entry[j] = (FAT_cluster == hex_last_cluster) ? 0xFFF : FAT_cluster + 1;
+            }
+            #endif
+            else FAT_entry[j] = 0;
+        }
+        packed[0] = (uint8_t)FAT_entry[0];
+        packed[1] = (uint8_t)(FAT_entry[0] >> 8) | (uint8_t)(FAT_entry[1] << 4);
+        packed[2] = (uint8_t)(FAT_entry[1] >> 4);
+        for(; pos < 3 && i < MSD_EP_SIZE; pos++) g_msd_ep_in[i++] = packed[pos];
+        pos = 0;
+    }
     
-    #if ((PROG_MEM_CLUST + FILE_CLUSTERS) * 2) <= MSD_EP_SIZE // If FAT fits into MSD_EP_SIZE, use this code, it's more compact.
+    #elif ((PROG_MEM_CLUST + FILE_CLUSTERS) * 2) <= MSD_EP_SIZE && !defined(USE_PROG_MEM_HEX) // If FAT fits into MSD_EP_SIZE, use this code, it's more compact.
     if(g_msd_byte_of_sect == 0)
     {
         p_FAT_entry[0] = 0xFFF8;
@@ -264,10 +666,16 @@ static void generate_FAT(void)
         #ifdef HAS_EEPROM
         p_FAT_entry[3] = 0xFFFF;
         #endif
+        #ifdef HAS_STATUS_FILE
+        p_FAT_entry[STATUS_CLUST] = 0xFFFF;
+        #endif
+        #ifdef USE_PROG_MEM_CRC
+        p_FAT_entry[CRC_CLUST] = 0xFFFF;
+        #endif
         
         if(user_firmware)
         {
-            for(FAT_cluster = PROG_MEM_CLUST; FAT_cluster < (PROG_MEM_CLUST + FILE_CLUSTERS - 1); FAT_cluster++)
+            for(FAT_cluster = PROG_MEM_CLUST; FAT_cluster < (PROG_MEM_CLUST + PROG_MEM_CLUSTERS - 1); FAT_cluster++)
             {
                 p_FAT_entry[FAT_cluster] = FAT_cluster + 1;
             }
@@ -276,7 +684,9 @@ static void generate_FAT(void)
     }
     
     #else // FAT is larger than MSD_EP_SIZE
-    if(g_msd_byte_of_sect == 0)
+    // Convert LBA and g_msd_byte_of_sect to the first FAT_cluster of the packet, 256 entries per sector.
+    FAT_cluster = (uint16_t)((g_msd_rw_10_vars.LBA - FAT_SECT_ADDR) << 8) + (g_msd_byte_of_sect >> 1);
+    if(FAT_cluster == 0)
     {
         p_FAT_entry[0] = 0xFFF8;
         p_FAT_entry[1] = 0xFFFF;
@@ -284,30 +694,35 @@ static void generate_FAT(void)
         #ifdef HAS_EEPROM
         p_FAT_entry[3] = 0xFFFF;
         #endif
-        FAT_cluster = PROG_MEM_CLUST;
-    }
-    else
-    {
-        // Convert g_msd_byte_of_sect to FAT_cluster location by dividing by 2.
-        FAT_cluster = (g_msd_byte_of_sect >> 1);
+        #ifdef HAS_STATUS_FILE
+        p_FAT_entry[STATUS_CLUST] = 0xFFFF;
+        #endif
+        #ifdef USE_PROG_MEM_CRC
+        p_FAT_entry[CRC_CLUST] = 0xFFFF;
+        #endif
     }
     
     // If chip is erased, don't generate FAT entries for PROG_MEM.
     if(!user_firmware) return; 
     
-    // Detect past the end of PROG_MEM file, don't generate any more FAT entries.
-    if(FAT_cluster > (PROG_MEM_CLUST + FILE_CLUSTERS)) return; 
+    last_cluster = PROG_MEM_CLUST + PROG_MEM_CLUSTERS - 1;
+    #ifdef USE_PROG_MEM_HEX
+    hex_last_cluster = HEX_CLUST + (uint16_t)((hex_file_size() + CLUSTER_SIZE - 1) / CLUSTER_SIZE) - 1;
+    #endif
     
-    for(uint16_t i = FAT_cluster % (MSD_EP_SIZE / 2); i < (MSD_EP_SIZE / 2); i++)
+    for(uint16_t i = 0; i < (MSD_EP_SIZE / 2); i++, FAT_cluster++)
     {
-        // If last cluster, finish with EOF entry.
-        if(FAT_cluster == (PROG_MEM_CLUST + FILE_CLUSTERS - 1))
+        // Each cluster of a file points to the next, the last is EOF.
+        if(FAT_cluster >= PROG_MEM_CLUST && FAT_cluster <= last_cluster)
         {
-            p_FAT_entry[i] = 0xFFFF;
-            break;
+            p_FAT_entry[i] = (FAT_cluster == last_cluster) ? 0xFFFF : FAT_cluster + 1;
         }
-        p_FAT_entry[i] = FAT_cluster + 1;
-        FAT_cluster++;
+        #ifdef USE_PROG_MEM_HEX
+        else if(FAT_cluster >= HEX_CLUST && FAT_cluster <= hex_last_cluster)
+        {
+            p_FAT_entry[i] = (FAT_cluster == hex_last_cluster) ? 0xFFFF : FAT_cluster + 1;
+        }
+        #endif
     }
     #endif
     #endif
@@ -327,7 +742,7 @@ static void generate_root(void)
         #ifndef SIMPLE_BOOTLOADER
         usb_rom_copy(ROOT.FILE1, &g_msd_ep_in[32], 11);
         g_msd_ep_in[43] = 0x21; // ATTR_READ_ONLY (0x01) | ATTR_ARCHIVE (0x20).
-        g_msd_ep_in[58] = 2;
+        g_msd_ep_in[58] = ABOUT_CLUST;
         g_msd_ep_in[60] = (uint8_t)sizeof(aboutFile);
         g_msd_ep_in[61] = (uint8_t)(sizeof(aboutFile) >> 8);
         #endif
@@ -338,239 +753,1475 @@ static void generate_root(void)
         #ifdef HAS_EEPROM
         usb_rom_copy(ROOT.FILE2, &g_msd_ep_in[0], 11);
         g_msd_ep_in[11] = 0x20; // ATTR_ARCHIVE.
-        g_msd_ep_in[26] = 3;
+        g_msd_ep_in[26] = EEPROM_CLUST;
         g_msd_ep_in[28] = (uint8_t)EEPROM_SIZE;
         g_msd_ep_in[29] = (uint8_t)(EEPROM_SIZE >> 8);
         if(user_firmware)
         {
             usb_rom_copy(ROOT.FILE3, &g_msd_ep_in[32], 11);
+            #ifdef USE_BIN_WRITE
+            g_msd_ep_in[43] = 0x20; // ATTR_ARCHIVE.
+            #else
             g_msd_ep_in[43] = 0x21; // ATTR_READ_ONLY | ATTR_ARCHIVE.
-            g_msd_ep_in[58] = (uint8_t)PROG_MEM_CLUST;
-            g_msd_ep_in[60] = (uint8_t)FILE_SIZE;
-            g_msd_ep_in[61] = (uint8_t)(FILE_SIZE >> 8);
-            #if FILE_SIZE >= 0x10000
-            g_msd_ep_in[62] = (uint8_t)(FILE_SIZE >> 16);
             #endif
+            g_msd_ep_in[58] = (uint8_t)PROG_MEM_CLUST;
+            *((uint24_t*)&g_msd_ep_in[60]) = PROG_MEM_SIZE;
         }
         #else
         if(user_firmware)
         {
             usb_rom_copy(ROOT.FILE2, &g_msd_ep_in[0], 11);
+            #ifdef USE_BIN_WRITE
+            g_msd_ep_in[11] = 0x20; // ATTR_ARCHIVE (0x20).
+            #else
             g_msd_ep_in[11] = 0x21; // ATTR_READ_ONLY (0x01) | ATTR_ARCHIVE (0x20).
-            g_msd_ep_in[26] = (uint8_t)PROG_MEM_CLUST;
-            g_msd_ep_in[28] = (uint8_t)FILE_SIZE;
-            g_msd_ep_in[29] = (uint8_t)(FILE_SIZE >> 8);
-            #if FILE_SIZE >= 0x10000
-            g_msd_ep_in[30] = (uint8_t)(FILE_SIZE >> 16);
             #endif
+            g_msd_ep_in[26] = (uint8_t)PROG_MEM_CLUST;
+            *((uint24_t*)&g_msd_ep_in[28]) = PROG_MEM_SIZE;
         }
         #endif
     }
     #endif
+    
+    #ifdef HAS_STATUS_FILE
+    // STATUS.TXT follows PROG_MEM.BIN, or takes its place when there's no user firmware.
+    uint8_t entry = (uint8_t)((STATUS_ROOT_ENTRY + user_firmware) * 32);
+    if(g_msd_byte_of_sect == (entry & ~(MSD_EP_SIZE - 1)))
+    {
+        uint8_t *p_entry = &g_msd_ep_in[entry & (MSD_EP_SIZE - 1)];
+        usb_rom_copy(ROOT.STATUS, p_entry, 11);
+        p_entry[11] = 0x21; // ATTR_READ_ONLY | ATTR_ARCHIVE.
+        p_entry[26] = STATUS_CLUST;
+        p_entry[28] = sizeof(statusFile) - 1;
+    }
+    #endif
+    
+    #ifdef USE_PROG_MEM_CRC
+    // PROG_MEM.CRC follows STATUS.TXT, both move up one with PROG_MEM.BIN.
+    uint8_t crc_entry = (uint8_t)((CRC_ROOT_ENTRY + user_firmware) * 32);
+    if(g_msd_byte_of_sect == (crc_entry & ~(MSD_EP_SIZE - 1)))
+    {
+        uint8_t *p_crc_entry = &g_msd_ep_in[crc_entry & (MSD_EP_SIZE - 1)];
+        usb_rom_copy(ROOT.CRC, p_crc_entry, 11);
+        p_crc_entry[11] = 0x21; // ATTR_READ_ONLY | ATTR_ARCHIVE.
+        p_crc_entry[26] = CRC_CLUST;
+        p_crc_entry[28] = sizeof(crcFile) - 1;
+    }
+    #endif
+    
+    #ifdef USE_PROG_MEM_HEX
+    if(user_firmware && g_msd_byte_of_sect == ((HEX_ROOT_ENTRY * 32) & ~(MSD_EP_SIZE - 1)))
+    {
+        uint8_t *p_hex_entry = &g_msd_ep_in[(HEX_ROOT_ENTRY * 32) & (MSD_EP_SIZE - 1)];
+        usb_rom_copy(ROOT.HEX, p_hex_entry, 11);
+        p_hex_entry[11] = 0x21; // ATTR_READ_ONLY | ATTR_ARCHIVE.
+        *((uint16_t*)&p_hex_entry[26]) = HEX_CLUST;
+        *((uint24_t*)&p_hex_entry[28]) = hex_file_size();
+    }
+    #endif
 }
 
+#ifdef HAS_STATUS_FILE
+static void reset_status(void)
+{
+    m_status.magic = STATUS_MAGIC;
+    m_status.rows_written = 0;
+    m_status.rows_skipped = 0;
+    #ifdef USE_VERIFY
+    m_status.retries  = 0;
+    m_status.failures = 0;
+    #endif
+    #ifdef USE_DELTA
+    m_status.patches_rejected = 0;
+    #endif
+}
 
-static bool update_erase_block(uint24_t address, uint8_t* data, uint8_t cnt)
+static void generate_status(void)
 {
-    uint16_t i;
-    uint8_t  block_index = address & INDEX_MASK;
-    uint24_t flash_addr  = address & FLASH_ADDR_MASK;
+    uint8_t size;
+    
+    if(g_msd_byte_of_sect >= sizeof(statusFile) - 1) return;
+    size = (uint8_t)(sizeof(statusFile) - 1 - g_msd_byte_of_sect);
+    if(size > MSD_EP_SIZE) size = MSD_EP_SIZE;
+    usb_rom_copy(statusFile + g_msd_byte_of_sect, g_msd_ep_in, size);
+    if(m_status.magic != STATUS_MAGIC) return; // No session since power up, leave counts at zero.
+    #ifdef USE_SKIP_SAME
+    put_dec(STATUS_WRITTEN_POS, m_status.rows_written);
+    put_dec(STATUS_SKIPPED_POS, m_status.rows_skipped);
+    #endif
+    #ifdef USE_VERIFY
+    put_dec(STATUS_RETRIES_POS, m_status.retries);
+    put_dec(STATUS_FAILURES_POS, m_status.failures);
+    #endif
+    #ifdef USE_DELTA
+    put_dec(STATUS_REJECTED_POS, m_status.patches_rejected);
+    #endif
+}
 
-    if((flash_addr != m_prev_flash_addr) && (m_prev_block_index != 0)) // If new block
-    {
-        if(!safely_write_block(m_prev_flash_addr)) return false; // Write remaining data in m_flash_block to flash for previous flash address
-        usb_ram_set(0xFF, m_flash_block, sizeof(m_flash_block)); // Fill new block with 0xFF            
-    }
+static void put_dec(uint8_t pos, uint16_t value)
+{
+    // Writes value as 5 decimal digits at pos in STATUS.TXT, if it's in the
+    // packet being sent.
+    uint8_t i = 5;
     
-    for(i = 0; i < cnt; i++) // Write DATA_REC data into m_flash_block 
+    pos -= (uint8_t)g_msd_byte_of_sect;
+    if(pos >= MSD_EP_SIZE) return;
+    do
     {
-        m_flash_block[block_index++] = *data;
-        data++;
-        if(block_index == sizeof(m_flash_block)) break; // Break if m_flash_block is full, it's possible that data still remains
-    }
+        i--;
+        g_msd_ep_in[pos + i] = '0' + (uint8_t)(value % 10);
+        value /= 10;
+    }while(i);
+}
+#endif
 
-    if(block_index == sizeof(m_flash_block))
+#ifdef USE_PROG_MEM_CRC
+static void generate_crc(void)
+{
+    // The CRCs are worked out when PROG_MEM.CRC is first read, and kept until
+    // the next write. Programming always ends in a reset, so flash can't
+    // change under them. g_msd_ep_in is the read buffer, it's sent after.
+    uint24_t end;
+    uint8_t  size;
+    
+    if(g_msd_byte_of_sect >= sizeof(crcFile) - 1) return;
+    if(!m_crc_valid)
     {
-        if(!safely_write_block(flash_addr)) return false;        // Write completed m_flash_block to flash
-        usb_ram_set(0xFF, m_flash_block, sizeof(m_flash_block)); // Fill new block with 0xFF        
-        block_index = 0;                                         // Reset m_flash_block index
-        i++;
-        if(i < cnt)                                              // If data still remains
+        m_crc_flash = flash_crc32(g_msd_ep_in);
+        #ifdef _PIC14E
+        end = (uint24_t)Flash_UsedEnd(PROG_REGION_START / 2, PROG_REGION_END / 2) * 2;
+        #else
+        end = Flash_UsedEnd(PROG_REGION_START, PROG_REGION_END);
+        #endif
+        m_crc_length = end - PROG_REGION_START;
+        #ifdef HAS_EEPROM
+        m_crc_eeprom = 0xFFFFFFFF;
+        for(end = 0; end < EEPROM_SIZE; end += size)
         {
-            for(i = i; i < cnt; i++)                             // Write remaining data to new m_flash_block
-            {
-                m_flash_block[block_index++] = *data;
-                data++;
-            }
+            size = (EEPROM_SIZE - end > MSD_EP_SIZE) ? MSD_EP_SIZE : (uint8_t)(EEPROM_SIZE - end); // Emulated EEPROM can be smaller.
+            eeprom_read_bytes((uint8_t)end, size, g_msd_ep_in);
+            m_crc_eeprom = crc32_update(m_crc_eeprom, g_msd_ep_in, size);
         }
-        flash_addr += sizeof(m_flash_block);
+        m_crc_eeprom = ~m_crc_eeprom;
+        #endif
+        read_config_words(g_msd_ep_in);
+        m_crc_config = ~crc32_update(0xFFFFFFFF, g_msd_ep_in, CONFIG_WORDS_SIZE);
+        m_crc_valid = true;
+        usb_ram_set(0, g_msd_ep_in, MSD_EP_SIZE);
     }
-    m_prev_block_index = block_index;
-    m_prev_flash_addr  = flash_addr;
     
-    return true;
+    size = (uint8_t)(sizeof(crcFile) - 1 - g_msd_byte_of_sect);
+    if(size > MSD_EP_SIZE) size = MSD_EP_SIZE;
+    usb_rom_copy(crcFile + g_msd_byte_of_sect, g_msd_ep_in, size);
+    put_hex32(CRC_FLASH_POS, m_crc_flash);
+    put_hex32(CRC_LENGTH_POS, m_crc_length);
+    #ifdef HAS_EEPROM
+    put_hex32(CRC_EEPROM_POS, m_crc_eeprom);
+    #endif
+    put_hex32(CRC_CONFIG_POS, m_crc_config);
 }
 
-static uint8_t hex_parse(uint8_t chr)
+static void put_hex32(uint8_t pos, uint32_t value)
 {
-    static uint8_t  ret_code, hex_state = HEX_START;
-    static uint8_t  rec_len, chksum_calc, rectype, data[16], data_index;
-    static uint16_t load_offset, char_cnt = 0, parse_data = 0;
-    static uint24_t ULBA_calc = 0;
-    static bool     is_hex_data, new_state = false;
+    // Writes value as 8 hex digits at pos in PROG_MEM.CRC, if it's in the
+    // packet being sent.
+    uint8_t i = 8;
+    uint8_t nibble;
     
-    is_hex_data = hex_char_to_char(&chr);
+    pos -= (uint8_t)g_msd_byte_of_sect;
+    if(pos >= MSD_EP_SIZE) return;
+    do
+    {
+        i--;
+        nibble = (uint8_t)value & 0x0F;
+        g_msd_ep_in[pos + i] = (nibble < 10) ? ('0' + nibble) : ('A' - 10 + nibble);
+        value >>= 4;
+    }while(i);
+}
+#endif
 
-    // If this is not the start of the HEX record, and chr is not 0-9 or A-F in ASCII, this is an error.
-    if(hex_state != HEX_START && is_hex_data == false) return HEX_FAULT;
-    
-    ret_code  = HEX_PARSING;
-    parse_data = (parse_data << 4) | chr;
-    char_cnt++;
+#if defined(USE_PROG_MEM_HEX) || defined(USE_PROG_MEM_CRC)
+static void read_config_words(uint8_t *p_data)
+{
+    #if defined(_PIC14E)
+    uint8_t i;
     
-    if(hex_state == HEX_START)
-    {   // Wait for start of file ':'
-        if(chr == '\r' || chr == '\n') {}
-        else if(chr == ':')
-        {
-            hex_state = HEX_REC_LEN;
-            new_state = true;
-        }
-        else ret_code = HEX_FAULT;
-    }
-    else if(hex_state == HEX_REC_LEN && char_cnt == 2)
-    {   // Get Record length
-        rec_len = (uint8_t)parse_data;
-        if(rec_len <= 0x10) // Support only up to 16 byte rows.
-        {
-            chksum_calc = rec_len;
-            hex_state   = HEX_LOAD_OFFSET;
-            new_state   = true;
-        }
-        else ret_code = HEX_FAULT;
-    }
-    else if(hex_state == HEX_LOAD_OFFSET && char_cnt == 4)
-    {   // Get Load Offset (offset address from current base address)
-        load_offset  = parse_data;
-        chksum_calc += (uint8_t)load_offset;
-        chksum_calc += (uint8_t)(load_offset >> 8);
-        hex_state    = HEX_RECTYPE;
-        new_state    = true;
-    }
-    else if(hex_state == HEX_RECTYPE && char_cnt == 2)
-    {   // Get Record Type
-        rectype      = (uint8_t)parse_data;
-        chksum_calc += rectype;
-        if(rectype == DATA_REC) // Data Record
-        {
-            data_index = 0;
-            hex_state  = HEX_DATA;
-        }
-        else if(rectype == EOF_REC) hex_state = HEX_CHKSUM; // End of File Record
-        else if(rectype == ELA_REC) hex_state = HEX_ELA;    // Extended Linear Address Record
-        else ret_code  = HEX_FAULT;
-        new_state = true;
+    PMCON1 = 0xC0; // Config words need CFGS set.
+    PMADR = (CONFIG_WORDS_START / 2);
+    for(i = 0; i < CONFIG_WORDS_SIZE; i += 2)
+    {
+        PMCON1bits.RD = 1;
+        __asm("NOP");
+        __asm("NOP");
+        *p_data++ = PMDATL;
+        *p_data++ = PMDATH;
+        PMADR++;
     }
-    else if(hex_state == HEX_DATA && char_cnt == 2)
+    #else
+    Flash_ReadBytes(CONFIG_WORDS_START, CONFIG_WORDS_SIZE, p_data); // TBLRD reads the config words too.
+    #endif
+}
+#endif
+
+#ifdef USE_PROG_MEM_HEX
+static void generate_hex(void)
+{
+    // PROG_MEM.HEX is a list of segments, each an ELA record followed by data
+    // records of HEX_REC_BYTES (the last can be shorter), then an EOF record.
+    // Records in a segment are all the same length, so the one under any file
+    // offset is found without rendering the ones before it.
+    uint24_t offset = ((uint24_t)(g_msd_rw_10_vars.LBA - HEX_SECT_ADDR) << 9) + g_msd_byte_of_sect;
+    uint24_t seg_addr, seg_size, chars;
+    uint24_t rec_addr;
+    uint16_t rec;
+    uint8_t  seg = 0;
+    uint8_t  data[HEX_REC_BYTES];
+    
+    // Find the segment the packet starts in.
+    while(hex_segment(seg, &seg_addr, &seg_size))
     {
-        data[data_index] = (uint8_t)parse_data;
-        chksum_calc += data[data_index++];
-        if(data_index >= rec_len) hex_state = HEX_CHKSUM;
-        new_state = true;
+        chars = hex_segment_chars(seg_size);
+        if(offset < chars) break;
+        offset -= chars;
+        seg++;
     }
-    else if(hex_state == HEX_ELA && char_cnt == 4)
+    if(hex_segment(seg, &seg_addr, &seg_size) && offset >= HEX_ELA_CHARS)
     {
-        chksum_calc += (uint8_t)parse_data;
-        chksum_calc += (uint8_t)(parse_data >> 8);
-        ULBA_calc = ((uint24_t)parse_data) << 16;
-        hex_state = HEX_CHKSUM;
-        new_state = true;
+        offset -= HEX_ELA_CHARS;
+        rec = (uint16_t)(offset / HEX_REC_CHARS) + 1;
+        offset %= HEX_REC_CHARS;
     }
-    else if(hex_state == HEX_CHKSUM && char_cnt == 2)
+    else rec = 0; // ELA record, or the EOF record after the last segment.
+    
+    if(offset >= MSD_EP_SIZE) return; // Past the end of the file.
+    m_hex_pos = -(int8_t)offset;
+    while(m_hex_pos < MSD_EP_SIZE)
     {
-        chksum_calc += (uint8_t)parse_data;
-        if(chksum_calc) ret_code = HEX_FAULT;
+        if(!hex_segment(seg, &seg_addr, &seg_size))
+        {
+            hex_put_record(EOF_REC, 0, 0, data);
+            return;
+        }
+        if(rec == 0)
+        {
+            data[0] = 0;
+            data[1] = (uint8_t)(seg_addr >> 16);
+            hex_put_record(ELA_REC, 0, 2, data);
+        }
         else
         {
-            if(rectype == DATA_REC) // Data Record
-            {
-                if(!update_erase_block(ULBA_calc + (uint24_t)load_offset, data, rec_len)) ret_code = HEX_FAULT;
-            }
-            else if(rectype == EOF_REC) // End of File Record
+            rec_addr = seg_addr + (uint24_t)(rec - 1) * HEX_REC_BYTES;
+            if(rec_addr >= seg_addr + seg_size) // End of segment.
             {
-                ret_code = HEX_FINISHED;
-                if(m_prev_block_index != 0) // Data left in m_flash_block not yet written.
-                {
-                    if(!safely_write_block(m_prev_flash_addr)) ret_code = HEX_FAULT;
-                }
+                seg++;
+                rec = 0;
+                continue;
             }
-            hex_state = HEX_START;
-            new_state = true;
+            chars = seg_addr + seg_size - rec_addr;
+            if(chars > HEX_REC_BYTES) chars = HEX_REC_BYTES;
+            hex_read(rec_addr, (uint8_t)chars, data);
+            hex_put_record(DATA_REC, (uint16_t)rec_addr, (uint8_t)chars, data);
         }
+        rec++;
     }
+}
+
+static bool hex_segment(uint8_t seg, uint24_t *p_addr, uint24_t *p_size)
+{
+    // Segment seg of PROG_MEM.HEX. User flash is split at 64KB boundaries,
+    // then EEPROM and the config words. Addresses are HEX file addresses.
+    uint24_t addr = PROG_REGION_START;
+    uint24_t end  = PROG_REGION_START + HEX_PROG_SIZE;
+    uint24_t seg_end;
     
-    if(new_state)
+    while(addr < end)
+    {
+        seg_end = (addr | 0xFFFF) + 1;
+        if(seg_end > end) seg_end = end;
+        if(seg-- == 0)
+        {
+            *p_addr = addr;
+            *p_size = seg_end - addr;
+            return true;
+        }
+        addr = seg_end;
+    }
+    #ifdef EEPROM_REGION_START
+    if(seg-- == 0)
     {
-        char_cnt  = 0;
-        parse_data = 0;
-        new_state = false;
+        *p_addr = EEPROM_REGION_START;
+        *p_size = EEPROM_SIZE;
+        return true;
     }
-    
-    return ret_code;
+    #endif
+    if(seg == 0)
+    {
+        *p_addr = CONFIG_WORDS_START;
+        *p_size = CONFIG_WORDS_SIZE;
+        return true;
+    }
+    return false;
 }
 
-static bool hex_char_to_char(uint8_t* chr)
+static uint24_t hex_segment_chars(uint24_t size)
 {
-    if((*chr > '/') && (*chr < ':'))      *chr -= 48; // It's a number
-    else if((*chr > '@') && (*chr < 'G')) *chr -= 55; // It's a letter
-    else return false; // Not ASCII HEX
+    uint24_t chars = HEX_ELA_CHARS + (size / HEX_REC_BYTES) * HEX_REC_CHARS;
     
-    return true;
+    if(size % HEX_REC_BYTES) chars += 13 + (size % HEX_REC_BYTES) * 2;
+    return chars;
 }
 
-static void delete_file(void)
+static uint24_t hex_file_size(void)
 {
-#if defined(_PIC14E)
-    Flash_Erase(PROG_REGION_START / 2, END_OF_FLASH / 2);
-#elif defined(__J_PART)
-    Flash_Erase(PROG_REGION_START, CONFIG_PAGE_START);
-#else
-    Flash_Erase(PROG_REGION_START, END_OF_FLASH);
-#endif
+    uint24_t addr, size;
+    uint24_t chars = HEX_EOF_CHARS;
+    uint8_t  seg = 0;
+    
+    while(hex_segment(seg++, &addr, &size)) chars += hex_segment_chars(size);
+    return chars;
 }
 
-static bool safely_write_block(uint24_t start_addr)
+static void hex_read(uint24_t address, uint8_t bytes, uint8_t *p_data)
 {
-#ifdef __J_PART
-    if(start_addr < CONFIG_PAGE_START && start_addr >= PROG_REGION_START) Flash_WriteBlock(start_addr, m_flash_block);
+    #ifdef EEPROM_REGION_START
+    if(address >= EEPROM_REGION_START)
+    {
+        eeprom_read_bytes((uint8_t)address, bytes, p_data);
+        return;
+    }
+    #endif
+    if(address == CONFIG_WORDS_START) read_config_words(p_data); // The config segment is a single record.
+    #if defined(_PIC14E)
+    else Flash_ReadBytes((uint16_t)(address / 2), bytes, p_data);
+    #else
+    else Flash_ReadBytes(address, bytes, p_data);
+    #endif
+}
+
+static void hex_put_record(uint8_t type, uint16_t address, uint8_t bytes, uint8_t *p_data)
+{
+    m_hex_sum = 0;
+    hex_put_char(':');
+    hex_put_byte(bytes);
+    hex_put_byte((uint8_t)(address >> 8));
+    hex_put_byte((uint8_t)address);
+    hex_put_byte(type);
+    while(bytes--) hex_put_byte(*p_data++);
+    hex_put_byte((uint8_t)(0 - m_hex_sum));
+    hex_put_char('\r');
+    hex_put_char('\n');
+}
+
+static void hex_put_byte(uint8_t value)
+{
+    uint8_t nibble = value >> 4;
+    
+    m_hex_sum += value;
+    hex_put_char((nibble < 10) ? ('0' + nibble) : ('A' - 10 + nibble));
+    nibble = value & 0x0F;
+    hex_put_char((nibble < 10) ? ('0' + nibble) : ('A' - 10 + nibble));
+}
+
+static void hex_put_char(uint8_t c)
+{
+    // Only characters that land in this packet are kept.
+    if(m_hex_pos >= 0 && m_hex_pos < MSD_EP_SIZE) g_msd_ep_in[m_hex_pos] = c;
+    m_hex_pos++;
+}
+#endif
+
+
+static bool update_erase_block(uint24_t address)
+{
+    uint24_t flash_addr = address & FLASH_ADDR_MASK;
+
+    #ifdef EEPROM_REGION_START
+    m_ee_record = (address >= EEPROM_REGION_START) && (address < END_OF_EEPROM);
+    if(m_ee_record)
+    {
+        m_ee_index = (uint16_t)(address - EEPROM_REGION_START);
+        return true; // m_flash_block is left as it is, flash data may continue in it.
+    }
+    #endif
+    #ifdef USE_BLOCK_CACHE
+    if(flash_addr != m_block_addr) // If new block
+    {
+        if(!switch_block(flash_addr, false)) return false; // Keep previous block in the cache, records may come back to it.
+    }
+    #else
+    if((flash_addr != m_block_addr) && (m_block_index != 0)) // If new block
+    {
+        if(!safely_write_block(m_block_addr)) return false;     // Write remaining data in m_flash_block to flash for previous flash address
+        usb_ram_set(0xFF, m_flash_block, sizeof(m_flash_block)); // Fill new block with 0xFF
+        #ifdef USE_SKIP_BLANK
+        m_block_and = 0xFF;
+        #endif
+    }
+    #endif
+    m_block_addr  = flash_addr;
+    m_block_index = address & INDEX_MASK;
+    
+    return true;
+}
+
+static bool insert_block_byte(uint8_t data)
+{
+    #ifdef EEPROM_REGION_START
+    if(m_ee_record)
+    {
+        if(m_ee_index >= EEPROM_SIZE) return false; // Record runs past the end of EEPROM.
+        eeprom_write((uint8_t)m_ee_index++, data);
+        return true;
+    }
+    #endif
+    #if defined(USE_SKIP_BLANK) && defined(_PIC14E)
+    m_block_and &= (m_block_index & 1) ? (data | 0xC0) : data; // Blank words are 0x3FFF.
+    #elif defined(USE_SKIP_BLANK)
+    m_block_and &= data;
+    #endif
+    m_flash_block[m_block_index++] = data;
+    
+    #ifdef USE_BLOCK_CACHE
+    m_block_used = true;
+    if(m_block_index == sizeof(m_flash_block))
+    {
+        if(!switch_block(m_block_addr + sizeof(m_flash_block), true)) return false;
+        m_block_index = 0;
+        m_block_addr += sizeof(m_flash_block);
+    }
+    #else
+    if(m_block_index == sizeof(m_flash_block))
+    {
+        if(!safely_write_block(m_block_addr)) return false;     // Write completed m_flash_block to flash
+        usb_ram_set(0xFF, m_flash_block, sizeof(m_flash_block)); // Fill new block with 0xFF
+        #ifdef USE_SKIP_BLANK
+        m_block_and = 0xFF;
+        #endif
+        m_block_index = 0;                                       // Reset m_flash_block index
+        m_block_addr += sizeof(m_flash_block);                   // Following data continues in the next block
+    }
+    #endif
+    
+    return true;
+}
+
+static bool flush_blocks(void)
+{
+    // Writes what's left at the end of an image.
+    #ifdef USE_BLOCK_CACHE
+    uint8_t i, j;
+    
+    if(m_block_used && !safely_write_block(m_block_addr)) return false;
+    m_block_used = false;
+    for(i = 0; i < BLOCK_CACHE_SLOTS; i++)
+    {
+        if(m_cache_age[i] == 0) continue;
+        m_cache_age[i] = 0;
+        for(j = 0; j < FLASH_WRITE_SIZE; j++) m_flash_block[j] = m_cache[i][j];
+        #ifdef USE_SKIP_BLANK
+        m_block_and = m_cache_and[i];
+        #endif
+        if(!safely_write_block(m_cache_addr[i])) return false;
+    }
+    return true;
+    #else
+    if(m_block_index == 0) return true; // Nothing left in m_flash_block.
+    return safely_write_block(m_block_addr);
+    #endif
+}
+
+#ifdef USE_BLOCK_CACHE
+static bool switch_block(uint24_t flash_addr, bool full)
+{
+    // Swaps m_flash_block for flash_addr's block, keeping the current block
+    // in the cache. A cached block comes back as it was, otherwise the least
+    // recently used slot is written out to make room and the block starts
+    // blank. Blocks filled to the end are unlikely to be revisited, so
+    // they're cached as least recently used and make way first.
+    uint8_t  i, slot = 0, tmp;
+    uint24_t evict_addr;
+    uint16_t evict_age = 0;
+    bool     hit = false;
+    
+    for(i = 0; i < BLOCK_CACHE_SLOTS; i++)
+    {
+        if(m_cache_age[i] != 0 && m_cache_addr[i] == flash_addr)
+        {
+            slot = i;
+            hit  = true;
+            break;
+        }
+        if(m_cache_age[i] < m_cache_age[slot]) slot = i; // Free slots are age 0.
+    }
+    
+    if(m_block_used || hit)
+    {
+        for(i = 0; i < FLASH_WRITE_SIZE; i++)
+        {
+            tmp = m_cache[slot][i];
+            m_cache[slot][i] = m_flash_block[i];
+            m_flash_block[i] = tmp;
+        }
+        #ifdef USE_SKIP_BLANK
+        tmp = m_cache_and[slot];
+        m_cache_and[slot] = m_block_and;
+        m_block_and = tmp;
+        #endif
+        evict_addr = m_cache_addr[slot];
+        evict_age  = m_cache_age[slot];
+        m_cache_addr[slot] = m_block_addr;
+        if(!m_block_used) m_cache_age[slot] = 0;
+        else if(full) m_cache_age[slot] = 1;
+        else
+        {
+            if(++m_cache_tick < 2) m_cache_tick = 2; // 0 is a free slot, 1 a full block.
+            m_cache_age[slot] = m_cache_tick;
+        }
+    }
+    
+    m_block_used = hit;
+    if(hit) return true;
+    
+    if(evict_age != 0) // m_flash_block now holds the evicted block.
+    {
+        if(!safely_write_block(evict_addr)) return false;
+    }
+    usb_ram_set(0xFF, m_flash_block, sizeof(m_flash_block));
+    #ifdef USE_SKIP_BLANK
+    m_block_and = 0xFF;
+    #endif
+    return true;
+}
+#endif
+
+static uint8_t start_image(void)
+{
+    uint8_t image;
+    
+    if(g_msd_ep_out[0] == ':') image = BOOT_LOAD_HEX; // First byte of HEX file is ':'.
+    #ifdef USE_UF2
+    else if(((UF2_HEADER_t*)g_msd_ep_out)->magicStart0 == UF2_MAGIC_START0 &&
+            ((UF2_HEADER_t*)g_msd_ep_out)->magicStart1 == UF2_MAGIC_START1) image = BOOT_LOAD_UF2;
+    #endif
+    #ifdef USE_UCLZ
+    else if(*((uint32_t*)g_msd_ep_out) == LZ_MAGIC) image = BOOT_LOAD_LZ;
+    #endif
+    #ifdef USE_DELTA
+    else if(*((uint32_t*)g_msd_ep_out) == DELTA_MAGIC)
+    {
+        // A patch only applies to the firmware it was made against. Any other
+        // is ignored, the drive stays ready for the right file.
+        if(*((uint32_t*)&g_msd_ep_out[4]) != flash_crc32(m_flash_block))
+        {
+            #ifdef HAS_STATUS_FILE
+            if(m_status.magic != STATUS_MAGIC) reset_status();
+            m_status.patches_rejected++;
+            #endif
+            return BOOT_DUMMY;
+        }
+        image = BOOT_LOAD_DELTA;
+    }
+    #endif
+    else return BOOT_DUMMY;
+    
+    #ifdef HAS_STATUS_FILE
+    reset_status();
+    #endif
+    #ifdef USE_VERIFY
+    m_write_failed = false;
+    #endif
+    #ifdef USE_DELTA
+    if(image == BOOT_LOAD_DELTA) return image; // Flash isn't erased, rows are only rewritten where the patch changes them.
+    #endif
+    
+    #ifdef USE_ERASE_ON_DEMAND
+    usb_ram_set(0, m_erased, sizeof(m_erased)); // Rows are erased as they're first written.
+    #else
+    if(user_firmware) delete_file();
+    #endif
+    usb_ram_set(0xFF, m_flash_block, sizeof(m_flash_block));
+    return image;
+}
+
+static uint8_t hex_parse(void)
+{
+    // Parses a whole g_msd_ep_out buffer per call. Records may span buffers,
+    // so the parser's position is kept in static variables between calls.
+    static uint8_t  hex_state = HEX_START;
+    static uint8_t  rec_len, rectype, field_cnt, chksum_calc, high_nibble;
+    static uint16_t load_offset;
+    static uint24_t ULBA_calc = 0;
+    static bool     low_nibble = false;
+    uint8_t *p_chr = g_msd_ep_out;
+    uint8_t chr, cnt = MSD_EP_SIZE;
+    
+    do
+    {
+        chr = *p_chr++;
+        
+        if(hex_state == HEX_START)
+        {   // Wait for start of record ':', skipping line endings.
+            if(chr == ':')
+            {
+                chksum_calc = 0;
+                hex_state   = HEX_REC_LEN;
+            }
+            else if(chr != '\r' && chr != '\n') return HEX_FAULT;
+            continue;
+        }
+        
+        // Inside a record, chr must be 0-9 or A-F in ASCII, anything else is an error.
+        if((uint8_t)(chr - '0') < 10)     chr -= '0';        // It's a number
+        else if((uint8_t)(chr - 'A') < 6) chr -= ('A' - 10); // It's a letter
+        else return HEX_FAULT;
+        
+        if(!low_nibble) // First character of the byte, wait for the second.
+        {
+            high_nibble = chr << 4;
+            low_nibble  = true;
+            continue;
+        }
+        low_nibble   = false;
+        chr         |= high_nibble;
+        chksum_calc += chr;
+        
+        if(hex_state == HEX_DATA)
+        {   // Decode data straight into m_flash_block.
+            if(!insert_block_byte(chr)) return HEX_FAULT;
+            if(--field_cnt == 0) hex_state = HEX_CHKSUM;
+        }
+        else if(hex_state == HEX_REC_LEN)
+        {   // Get Record length
+            rec_len   = chr; // Any length up to 255, data is streamed into m_flash_block as it arrives.
+            field_cnt = 2;
+            hex_state = HEX_LOAD_OFFSET;
+        }
+        else if(hex_state == HEX_LOAD_OFFSET)
+        {   // Get Load Offset (offset address from current base address), MSB first.
+            load_offset = (load_offset << 8) | chr;
+            if(--field_cnt == 0) hex_state = HEX_RECTYPE;
+        }
+        else if(hex_state == HEX_RECTYPE)
+        {   // Get Record Type
+            rectype   = chr;
+            field_cnt = rec_len;
+            if(rectype == DATA_REC) // Data Record
+            {
+                if(rec_len == 0) hex_state = HEX_CHKSUM;
+                else
+                {
+                    if(!update_erase_block(ULBA_calc + (uint24_t)load_offset)) return HEX_FAULT;
+                    hex_state = HEX_DATA;
+                }
+            }
+            else if(rectype == EOF_REC) hex_state = HEX_CHKSUM;                  // End of File Record
+            else if(rectype == ELA_REC && rec_len == 2) hex_state = HEX_ELA;     // Extended Linear Address Record
+            else return HEX_FAULT;
+        }
+        else if(hex_state == HEX_ELA)
+        {   // Only the low byte of the upper address word is needed for 24-bit addresses.
+            ULBA_calc = ((uint24_t)chr) << 16;
+            if(--field_cnt == 0) hex_state = HEX_CHKSUM;
+        }
+        else // HEX_CHKSUM
+        {
+            if(chksum_calc) return HEX_FAULT;
+            hex_state = HEX_START;
+            if(rectype == EOF_REC) // End of File Record
+            {
+                if(!flush_blocks()) return HEX_FAULT; // Data left in m_flash_block not yet written.
+                return HEX_FINISHED;
+            }
+        }
+    }while(--cnt);
+    
+    return HEX_PARSING;
+}
+
+#ifdef USE_UF2
+static uint8_t uf2_target(uint32_t address, uint32_t size)
+{
+    // Where a block's payload goes. size is at most UF2_MAX_PAYLOAD, so
+    // end - size can't wrap. Config and ID words are skipped, as the HEX
+    // parser does, anything else outside the user region and EEPROM is an error.
+    if(address >= PROG_REGION_START && address <= PROG_REGION_END - size) return UF2_WRITE;
+    #ifdef EEPROM_REGION_START
+    if(address >= EEPROM_REGION_START && address <= END_OF_EEPROM - size) return UF2_WRITE;
+    #endif
+    if(address >= CONFIG_PAGE_START && address <= CONFIG_BLOCK_REGION + FLASH_WRITE_SIZE - size) return UF2_SKIP;
+    #ifdef ID_REGION_START
+    if(address >= ID_REGION_START && address <= ID_REGION_START + FLASH_WRITE_SIZE - size) return UF2_SKIP;
+    #endif
+    return UF2_BAD;
+}
+
+static uint8_t uf2_parse(void)
+{
+    // Every 512 byte sector of a UF2 file is a self contained block, holding
+    // its target address and payload. Payload is copied straight into
+    // m_flash_block, no parsing needed. Uses the HEX parser's result codes.
+    static bool     uf2_block;
+    static uint16_t payload_end;
+    static uint16_t blocks_left = 0;
+    UF2_HEADER_t    *p_header = (UF2_HEADER_t*)g_msd_ep_out;
+    uint8_t i = 0;
+    uint8_t target;
+    
+    if(g_msd_byte_of_sect == 0)
+    {
+        // Sectors without the magic words aren't part of the image, ignore them.
+        // So are blocks for another family, in a file that holds several.
+        uf2_block = (p_header->magicStart0 == UF2_MAGIC_START0 && p_header->magicStart1 == UF2_MAGIC_START1);
+        if(uf2_block && (p_header->flags & UF2_FLAG_FAMILY_ID)) uf2_block = (p_header->familyID == UF2_FAMILY_ID);
+        if(!uf2_block) return HEX_PARSING;
+        
+        if(p_header->payloadSize > UF2_MAX_PAYLOAD) return HEX_FAULT;
+        if(blocks_left == 0) blocks_left = (uint16_t)p_header->numBlocks;
+        
+        // targetAddr is 32 bit, check it before it's cut down to 24. A block
+        // built for another chip's memory map would otherwise wrap into user flash.
+        target = (p_header->flags & UF2_FLAG_NOT_MAIN_FLASH) ? UF2_SKIP : uf2_target(p_header->targetAddr, p_header->payloadSize);
+        if(target == UF2_BAD) return HEX_FAULT;
+        if(target == UF2_SKIP) payload_end = 0; // Block is counted, but not written.
+        else
+        {
+            payload_end = UF2_DATA_OFFSET + (uint16_t)p_header->payloadSize;
+            if(!update_erase_block((uint24_t)p_header->targetAddr)) return HEX_FAULT;
+        }
+        i = UF2_DATA_OFFSET;
+    }
+    else if(!uf2_block) return HEX_PARSING;
+    
+    for(; i < MSD_EP_SIZE && (g_msd_byte_of_sect + i) < payload_end; i++)
+    {
+        if(!insert_block_byte(g_msd_ep_out[i])) return HEX_FAULT;
+    }
+    
+    if(g_msd_byte_of_sect == (BYTES_PER_BLOCK_LE - MSD_EP_SIZE)) // Last packet of the block.
+    {
+        if(*((uint32_t*)&g_msd_ep_out[MSD_EP_SIZE - 4]) != UF2_MAGIC_END) return HEX_FAULT;
+        if(--blocks_left == 0)
+        {
+            if(!flush_blocks()) return HEX_FAULT; // Data left in m_flash_block not yet written.
+            return HEX_FINISHED;
+        }
+    }
+    
+    return HEX_PARSING;
+}
+#endif
+
+#ifdef USE_UCLZ
+static uint8_t lz_parse(void)
+{
+    // Decompresses a UCLZ stream into m_flash_block. Matches copy from data
+    // already output, which is either still in m_flash_block or already
+    // written to flash, so no RAM window is needed. Uses the HEX parser's
+    // result codes.
+    static uint8_t  lz_state = LZ_HEADER;
+    static uint8_t  field_cnt = 4; // Skip "UCLZ".
+    static uint8_t  match_len;
+    static uint16_t dist;
+    static uint24_t address;
+    uint8_t *p_data = g_msd_ep_out;
+    uint8_t data, cnt = MSD_EP_SIZE;
+    
+    do
+    {
+        data = *p_data++;
+        
+        if(lz_state == LZ_LITERAL)
+        {
+            if(!insert_block_byte(data)) return HEX_FAULT;
+            if(--field_cnt == 0) lz_state = LZ_TAG;
+        }
+        else if(lz_state == LZ_TAG)
+        {
+            if(data < LZ_TAG_MATCH)
+            {
+                field_cnt = data + 1;
+                lz_state  = LZ_LITERAL;
+            }
+            else if(data < LZ_TAG_ADDR)
+            {
+                match_len = data - LZ_TAG_MATCH + LZ_MIN_MATCH;
+                field_cnt = 2;
+                lz_state  = LZ_DIST;
+            }
+            else if(data == LZ_TAG_ADDR)
+            {
+                field_cnt = 3;
+                lz_state  = LZ_ADDR;
+            }
+            else // LZ_TAG_END
+            {
+                if(!flush_blocks()) return HEX_FAULT; // Data left in m_flash_block not yet written.
+                return HEX_FINISHED;
+            }
+        }
+        else if(lz_state == LZ_DIST)
+        {   // Little endian, shift in from the top.
+            dist = (dist >> 8) | ((uint16_t)data << 8);
+            if(--field_cnt == 0)
+            {
+                if(!lz_copy(dist, match_len)) return HEX_FAULT;
+                lz_state = LZ_TAG;
+            }
+        }
+        else if(lz_state == LZ_ADDR)
+        {
+            address = (address >> 8) | ((uint24_t)data << 16);
+            if(--field_cnt == 0)
+            {
+                if(!update_erase_block(address)) return HEX_FAULT;
+                m_lz_seg_start = address; // Matches can't reach back past a new address.
+                lz_state = LZ_TAG;
+            }
+        }
+        else // LZ_HEADER
+        {
+            if(--field_cnt == 0) lz_state = LZ_TAG;
+        }
+    }while(--cnt);
+    
+    return HEX_PARSING;
+}
+
+static bool lz_copy(uint16_t dist, uint8_t len)
+{
+    uint24_t src = m_block_addr + m_block_index - dist;
+    uint8_t  data;
+    
+    if(dist == 0 || src < m_lz_seg_start) return false;
+    
+    do
+    {
+        if(!read_image_byte(src++, &data)) return false;
+        if(!insert_block_byte(data)) return false;
+    }while(--len);
+    
+    return true;
+}
+
+static bool read_image_byte(uint24_t address, uint8_t* p_data)
+{
+    #ifdef USE_BLOCK_CACHE
+    uint8_t i;
+    
+    for(i = 0; i < BLOCK_CACHE_SLOTS; i++)
+    {
+        if(m_cache_age[i] != 0 && m_cache_addr[i] == (address & FLASH_ADDR_MASK))
+        {
+            *p_data = m_cache[i][address & INDEX_MASK]; // Cached, not written yet.
+            return true;
+        }
+    }
+    #endif
+    if((address & FLASH_ADDR_MASK) == m_block_addr) *p_data = m_flash_block[address & INDEX_MASK]; // Not written yet.
+    #ifdef USE_DOUBLE_BUFFER
+    else if(m_commit_pending && (address & FLASH_ADDR_MASK) == m_commit_addr) *p_data = m_commit_block[address & INDEX_MASK];
+    #endif
+    #ifdef USE_SKIP_SAME
+    else if(m_row_open && (address & ROW_ADDR_MASK) == m_row_addr) *p_data = m_row[address & ROW_INDEX_MASK]; // Row not committed yet.
+    #endif
+    else if(address >= PROG_REGION_START && address < PROG_REGION_END)
+    {
+        #ifdef _PIC14E
+        uint8_t word[2];
+        Flash_ReadBytes(address / 2, 2, word);
+        *p_data = word[address & 1];
+        #else
+        Flash_ReadBytes(address, 1, p_data);
+        #endif
+    }
+    else return false; // Only user flash can be read back.
+    
+    return true;
+}
+#endif
+
+#ifdef USE_DELTA
+static uint8_t delta_parse(void)
+{
+    // Applies a delta patch through the erase row buffer, so only rows the
+    // patch actually changes are erased and rewritten. Uses the HEX parser's
+    // result codes.
+    static uint8_t  delta_state = DELTA_HEADER;
+    static uint8_t  field_cnt = 8; // Skip magic and CRC, checked by start_image().
+    static uint24_t address;
+    uint8_t *p_data = g_msd_ep_out;
+    uint8_t data, cnt = MSD_EP_SIZE;
+    
+    do
+    {
+        data = *p_data++;
+        
+        if(delta_state == DELTA_DATA)
+        {
+            if(address >= END_OF_FLASH || address < PROG_REGION_START) return HEX_FAULT;
+            if(address < PROG_REGION_END) row_write_byte(address, data); // J part config page is left alone.
+            address++;
+            if(--field_cnt == 0)
+            {
+                field_cnt   = 3;
+                delta_state = DELTA_ADDR;
+            }
+        }
+        else if(delta_state == DELTA_ADDR)
+        {   // Little endian, shift in from the top.
+            address = (address >> 8) | ((uint24_t)data << 16);
+            if(--field_cnt == 0) delta_state = DELTA_LEN;
+        }
+        else if(delta_state == DELTA_LEN)
+        {
+            if(data == 0) // End of patch.
+            {
+                commit_row();
+                return HEX_FINISHED;
+            }
+            field_cnt   = data;
+            delta_state = DELTA_DATA;
+        }
+        else // DELTA_HEADER
+        {
+            if(--field_cnt == 0)
+            {
+                field_cnt   = 3;
+                delta_state = DELTA_ADDR;
+            }
+        }
+    }while(--cnt);
+    
+    return HEX_PARSING;
+}
+#endif
+
+#if defined(USE_DELTA) || defined(USE_PROG_MEM_CRC)
+static uint32_t flash_crc32(uint8_t *p_buffer)
+{
+    // CRC-32 (as used by zip) of the PROG_MEM.BIN contents. p_buffer is a
+    // read buffer of at least FLASH_WRITE_SIZE bytes.
+    uint32_t crc = 0xFFFFFFFF;
+    uint24_t addr;
+    
+    uint24_t end = PROG_REGION_START + PROG_MEM_SIZE; // CRC of PROG_MEM.BIN as the host sees it.
+    
+    for(addr = PROG_REGION_START; addr < end; addr += FLASH_WRITE_SIZE)
+    {
+        #ifdef _PIC14E
+        Flash_ReadBytes(addr / 2, FLASH_WRITE_SIZE, p_buffer);
+        #else
+        Flash_ReadBytes(addr, FLASH_WRITE_SIZE, p_buffer);
+        #endif
+        crc = crc32_update(crc, p_buffer, FLASH_WRITE_SIZE);
+    }
+    
+    return ~crc;
+}
+
+static uint32_t crc32_update(uint32_t crc, uint8_t *p_data, uint8_t bytes)
+{
+    // Nibble table keeps it fast without a 1KB table. Start with 0xFFFFFFFF
+    // and invert the result.
+    static const uint32_t crc_table[16] =
+    {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    
+    while(bytes--)
+    {
+        crc ^= *p_data++;
+        crc = (crc >> 4) ^ crc_table[(uint8_t)crc & 0x0F];
+        crc = (crc >> 4) ^ crc_table[(uint8_t)crc & 0x0F];
+    }
+    return crc;
+}
+#endif
+
+#ifdef USE_TRIM_PROG_MEM
+static uint24_t prog_mem_size(void)
+{
+    // PROG_MEM.BIN ends at the last programmed byte, rounded up to a whole
+    // cluster. Flash is only scanned once, programming always ends in a reset.
+    static uint24_t size = 0;
+    
+    if(size == 0)
+    {
+        #ifdef _PIC14E
+        size = (uint24_t)Flash_UsedEnd(PROG_REGION_START / 2, PROG_REGION_END / 2) * 2;
+        #else
+        size = Flash_UsedEnd(PROG_REGION_START, PROG_REGION_END);
+        #endif
+        size = (size - PROG_REGION_START + 511) & ~(uint24_t)511;
+        if(size == 0) size = 512; // Blank, PROG_MEM.BIN isn't shown anyway.
+    }
+    return size;
+}
+#endif
+
+static void delete_file(void)
+{
+    #ifdef USE_ROW_RMW
+    m_row_open = false; // Row buffer is stale once flash is erased.
+    #endif
+    #ifdef USE_DOUBLE_BUFFER
+    m_commit_pending = false;
+    #endif
+    #ifdef USE_EEPROM_QUEUE
+    eeprom_flush();
+    #endif
+
+#if defined(_PIC14E)
+    ERASE_ROWS(PROG_REGION_START / 2, PROG_REGION_END / 2);
+#elif defined(__J_PART)
+    ERASE_ROWS(PROG_REGION_START, PROG_REGION_END);
+#else
+    ERASE_ROWS(PROG_REGION_START, END_OF_FLASH);
+#endif
+}
+
+static bool safely_write_block(uint24_t start_addr)
+{
+#ifdef __J_PART
+    if(start_addr < PROG_REGION_END && start_addr >= PROG_REGION_START)
+    {
+        #if defined(USE_SKIP_SAME)
+        row_write_block(start_addr);
+        #else
+        #ifdef USE_ERASE_ON_DEMAND
+        erase_on_demand(start_addr);
+        #endif
+        #ifdef USE_SKIP_BLANK
+        if(m_block_and != 0xFF) // Programming 0xFF doesn't change flash.
+        #endif
+        #ifdef USE_DOUBLE_BUFFER
+        queue_block(start_addr);
+        #else
+        write_block(start_addr, m_flash_block);
+        #endif
+        #endif
+        #ifdef USE_VERIFY
+        if(m_write_failed) return false;
+        #endif
+    }
+    #ifdef USE_EMU_EEPROM
+    else if(start_addr < CONFIG_PAGE_START) return false; // Emulated EEPROM pages, written through EEPROM.BIN only.
+    #endif
     else if(start_addr < END_OF_FLASH){}      
     else return false;
     return true;
 #else
-    if((start_addr < END_OF_FLASH) && (start_addr >= PROG_REGION_START))
+    if((start_addr < PROG_REGION_END) && (start_addr >= PROG_REGION_START))
     {
-        #ifdef _PIC14E
-        Flash_WriteBlock(start_addr / 2, m_flash_block);
+        #if defined(USE_SKIP_SAME)
+        row_write_block(start_addr);
         #else
-        Flash_WriteBlock(start_addr, m_flash_block);
+        #ifdef USE_ERASE_ON_DEMAND
+        erase_on_demand(start_addr);
+        #endif
+        #ifdef USE_SKIP_BLANK
+        if(m_block_and != 0xFF) // Programming 0xFF doesn't change flash.
+        #endif
+        #ifdef USE_DOUBLE_BUFFER
+        queue_block(start_addr);
+        #else
+        write_block(start_addr, m_flash_block);
+        #endif
+        #endif
+        #ifdef USE_VERIFY
+        if(m_write_failed) return false;
         #endif
     }
+    #ifdef USE_EMU_EEPROM
+    else if(start_addr < END_OF_FLASH) return false; // Emulated EEPROM pages, written through EEPROM.BIN only.
+    #endif
     #ifndef _PIC14E
     else if(start_addr == ID_REGION_START){}
     #endif
     else if(start_addr == CONFIG_REGION_START){}
-    #ifdef HAS_EEPROM
-    else if((start_addr < END_OF_EEPROM) && (start_addr >= EEPROM_REGION_START))
+    else if(start_addr < PROG_REGION_START){}
+    else return false;
+    return true;
+#endif
+}
+
+#ifndef USE_SKIP_SAME
+static void write_block(uint24_t start_addr, uint8_t* p_block)
+{
+    #ifdef USE_EEPROM_QUEUE
+    eeprom_flush();
+    #endif
+    #ifdef USE_VERIFY
+    // Reads the block back after writing it. A block that didn't program is
+    // written again, up to VERIFY_RETRIES times. The row is never erased here,
+    // it can hold data written earlier in the session.
+    uint8_t tries = 0;
+    
+    while(1)
     {
-        start_addr &= 0xFF;
-        for(uint8_t i = 0; i < _FLASH_WRITE_SIZE; i++) EEPROM_Write((uint8_t)start_addr + i, m_flash_block[i]);
+    #endif
+    #ifdef _PIC14E
+    Flash_WriteRange(start_addr / 2, FLASH_WRITE_SIZE, p_block);
+    #else
+    Flash_WriteRange(start_addr, FLASH_WRITE_SIZE, p_block);
+    #endif
+    #ifdef USE_VERIFY
+        if(flash_programmed(start_addr, p_block, FLASH_WRITE_SIZE)) return;
+        if(tries++ == VERIFY_RETRIES)
+        {
+            #ifdef HAS_STATUS_FILE
+            m_status.failures++;
+            #endif
+            m_write_failed = true;
+            return;
+        }
+        #ifdef HAS_STATUS_FILE
+        m_status.retries++;
+        #endif
     }
     #endif
-    else if(start_addr < PROG_REGION_START){}
-    else return false;
+}
+#endif
+
+#if defined(USE_ROW_RMW) && (defined(USE_SKIP_SAME) || defined(USE_VERIFY))
+static bool flash_matches(uint24_t address, uint8_t* p_data, uint16_t size)
+{
+    // Compares flash with p_data a word at a time.
+    uint8_t  word[2];
+    uint16_t i;
+    
+    for(i = 0; i < size; i += 2)
+    {
+        #ifdef _PIC14E
+        Flash_ReadBytes((address + i) / 2, 2, word);
+        if(word[0] != p_data[i] || word[1] != (p_data[i + 1] & 0x3F)) return false; // Only 14bit words.
+        #else
+        Flash_ReadBytes(address + i, 2, word);
+        if(word[0] != p_data[i] || word[1] != p_data[i + 1]) return false;
+        #endif
+    }
     return true;
+}
 #endif
+
+#if defined(USE_VERIFY) && !defined(USE_SKIP_SAME)
+static bool flash_programmed(uint24_t address, uint8_t* p_block, uint16_t size)
+{
+    // Checks the bits p_block programs (its 0s) read back as 0. Its 1s can
+    // read 0 where an earlier block wrote the same locations.
+    uint8_t  word[2];
+    uint16_t i;
+    
+    for(i = 0; i < size; i += 2)
+    {
+        #ifdef _PIC14E
+        Flash_ReadBytes((address + i) / 2, 2, word);
+        if((word[0] & ~p_block[i]) || (word[1] & ~p_block[i + 1] & 0x3F)) return false; // Only 14bit words.
+        #else
+        Flash_ReadBytes(address + i, 2, word);
+        if((word[0] & ~p_block[i]) || (word[1] & ~p_block[i + 1])) return false;
+        #endif
+    }
+    return true;
 }
+#endif
+
+#ifdef USE_DOUBLE_BUFFER
+static void queue_block(uint24_t start_addr)
+{
+    // Hands m_flash_block over to boot_tasks(). Only one block can wait, so
+    // an earlier one is written first.
+    uint8_t i;
+    
+    commit_block();
+    for(i = 0; i < FLASH_WRITE_SIZE; i++) m_commit_block[i] = m_flash_block[i];
+    m_commit_addr    = start_addr;
+    m_commit_pending = true;
+}
+
+static void commit_block(void)
+{
+    // Writes the queued block. From boot_tasks() this happens once the OUT
+    // packet that completed it has been handed back to the SIE, so the next
+    // packet can be received while the core is stalled.
+    if(!m_commit_pending) return;
+    m_commit_pending = false;
+    write_block(m_commit_addr, m_commit_block);
+}
+#endif
+
+#ifdef HAS_EEPROM
+static void eeprom_write(uint8_t address, uint8_t data)
+{
+    // All EEPROM writes go through here, so the mirror never has to be
+    // reloaded.
+    #ifdef USE_EEPROM_MIRROR
+    eeprom_load_mirror();
+    m_ee_mirror[address] = data;
+    #endif
+    #ifdef USE_EEPROM_QUEUE
+    eeprom_queue(address, data);
+    #else
+    EEPROM_Update(address, data);
+    #endif
+}
+#endif
+
+#if defined(HAS_EEPROM) && !defined(SIMPLE_BOOTLOADER)
+static void eeprom_read_bytes(uint8_t address, uint8_t bytes, uint8_t *p_data)
+{
+    // EEPROM as the host should see it, including writes still in the queue.
+    #if defined(USE_EEPROM_MIRROR)
+    eeprom_load_mirror();
+    while(bytes--) *p_data++ = m_ee_mirror[address++];
+    #elif defined(USE_EEPROM_QUEUE)
+    while(bytes--) *p_data++ = eeprom_read(address++);
+    #else
+    EEPROM_ReadBytes(address, bytes, p_data);
+    #endif
+}
+#endif
+
+#ifdef USE_EEPROM_MIRROR
+static void eeprom_load_mirror(void)
+{
+    // EEPROM is read once, the first time it's needed. Nothing has been
+    // queued before then, so EEPROM itself is up to date.
+    if(m_ee_mirror_valid) return;
+    EEPROM_ReadBytes(0, EEPROM_SIZE, m_ee_mirror);
+    m_ee_mirror_valid = true;
+}
+#endif
+
+#ifdef USE_EEPROM_QUEUE
+static void eeprom_queue(uint8_t address, uint8_t data)
+{
+    // Buffers an EEPROM byte for boot_tasks() to write, replacing one that's
+    // still waiting. All of EEPROM fits, so this never has to wait.
+    uint8_t mask = (uint8_t)(1 << (address & 7));
+    
+    m_ee_buf[address] = data;
+    if(m_ee_dirty[address >> 3] & mask) return;
+    m_ee_dirty[address >> 3] |= mask;
+    m_ee_pending++;
+}
+
+#if !defined(USE_EEPROM_MIRROR) && !defined(SIMPLE_BOOTLOADER)
+static uint8_t eeprom_read(uint8_t address)
+{
+    // EEPROM as it will be once the queue is written.
+    if(m_ee_dirty[address >> 3] & (uint8_t)(1 << (address & 7))) return m_ee_buf[address];
+    while(EEPROM_Busy()){} // EEADR can't be changed mid write.
+    return EEPROM_Read(address);
+}
+#endif
+
+static bool eeprom_service(void)
+{
+    // Starts the next write once the last one has finished, bytes that
+    // already match are skipped. Returns true while any are left.
+    uint8_t mask;
+    
+    while(m_ee_pending && !EEPROM_Busy())
+    {
+        mask = (uint8_t)(1 << (m_ee_next & 7));
+        if(m_ee_dirty[m_ee_next >> 3] & mask)
+        {
+            m_ee_dirty[m_ee_next >> 3] &= (uint8_t)~mask;
+            m_ee_pending--;
+            if(EEPROM_Read(m_ee_next) != m_ee_buf[m_ee_next]) EEPROM_WriteStart(m_ee_next, m_ee_buf[m_ee_next]);
+        }
+        m_ee_next = (uint8_t)((m_ee_next + 1) % EEPROM_SIZE);
+    }
+    return m_ee_pending || EEPROM_Busy();
+}
+
+static void eeprom_flush(void)
+{
+    // EECON1 can't be changed while an EEPROM write is in progress, so it
+    // has to be idle before flash is erased or written.
+    while(eeprom_service()){}
+}
+#endif
+
+#if defined(USE_ERASE_ON_DEMAND) && (!defined(USE_SKIP_SAME) || defined(FULL_WIPE))
+static void erase_on_demand(uint24_t address)
+{
+    // Erases the row containing address, unless it's already been erased
+    // this session.
+    uint16_t row = (uint16_t)((address - PROG_REGION_START) / FLASH_ERASE_SIZE);
+    uint8_t  mask = (uint8_t)(1 << (row & 7));
+    
+    if(m_erased[row >> 3] & mask) return;
+    m_erased[row >> 3] |= mask;
+    #ifdef USE_EEPROM_QUEUE
+    eeprom_flush();
+    #endif
+    
+    address &= ROW_ADDR_MASK;
+    #ifdef _PIC14E
+    ERASE_ROWS(address / 2, (address + FLASH_ERASE_SIZE) / 2);
+    #else
+    ERASE_ROWS(address, address + FLASH_ERASE_SIZE);
+    #endif
+}
+#endif
+
+#ifdef USE_BIN_WRITE
+static void bin_write(void)
+{
+    // PROG_MEM.BIN maps 1:1 onto flash.
+    uint24_t addr = (uint24_t)LBA_to_flash_addr(g_msd_rw_10_vars.LBA);
+    uint8_t  i;
+    
+    if(addr >= PROG_REGION_END) return; // J part config page is left alone.
+    
+    for(i = 0; i < MSD_EP_SIZE; i++) row_write_byte(addr + i, g_msd_ep_out[i]);
+    
+    if(((addr + MSD_EP_SIZE) & ROW_INDEX_MASK) == 0) commit_row(); // Row complete.
+}
+#endif
+
+#ifdef USE_ROW_RMW
+static void open_row(uint24_t address, bool blank)
+{
+    // Loads address's erase row into m_row, committing the row open before.
+    // A blank row starts as erased flash instead.
+    #ifdef USE_SKIP_SAME
+    uint16_t i;
+    #endif
+    
+    if(m_row_open && (address & ROW_ADDR_MASK) == m_row_addr) return;
+    
+    commit_row();
+    m_row_addr  = address & ROW_ADDR_MASK;
+    m_row_open  = true;
+    m_row_dirty = false;
+    #ifdef USE_SKIP_SAME
+    m_row_fresh = blank;
+    if(blank)
+    {
+        #ifdef _PIC14E
+        for(i = 0; i < FLASH_ERASE_SIZE; i += 2)
+        {
+            m_row[i]     = 0xFF;
+            m_row[i + 1] = 0x3F; // Only 14bit words.
+        }
+        #else
+        for(i = 0; i < FLASH_ERASE_SIZE; i++) m_row[i] = 0xFF;
+        #endif
+        return;
+    }
+    #endif
+    #ifdef _PIC14E
+    Flash_ReadBytes(m_row_addr / 2, FLASH_ERASE_SIZE, m_row);
+    #else
+    Flash_ReadBytes(m_row_addr, FLASH_ERASE_SIZE, m_row);
+    #endif
+}
+
+#if defined(USE_BIN_WRITE) || defined(USE_DELTA)
+static void row_write_byte(uint24_t address, uint8_t data)
+{
+    // Bytes are merged into a copy of their erase row, which is only erased
+    // and rewritten if anything changed.
+    uint16_t index = address & ROW_INDEX_MASK;
+    
+    open_row(address, false);
+    
+    #ifdef _PIC14E
+    if(index & 1) data &= 0x3F; // Only 14bit words.
+    #endif
+    if(m_row[index] != data)
+    {
+        m_row[index] = data;
+        m_row_dirty  = true;
+    }
+}
+#endif
+
+static void commit_row(void)
+{
+    #ifdef USE_VERIFY
+    uint8_t  tries;
+    #endif
+    
+    if(!m_row_open) return;
+    m_row_open = false;
+    #ifdef USE_SKIP_SAME
+    if(m_row_fresh) m_row_dirty = !flash_matches(m_row_addr, m_row, FLASH_ERASE_SIZE); // Flash may already hold this row.
+    #endif
+    if(!m_row_dirty) // Row unchanged, no need to erase.
+    {
+        #ifdef HAS_STATUS_FILE
+        m_status.rows_skipped++;
+        #endif
+        return;
+    }
+    
+    #ifdef USE_EEPROM_QUEUE
+    eeprom_flush();
+    #endif
+    #ifdef USE_VERIFY
+    for(tries = 0; ; tries++) // Erase and write the row again if it doesn't read back.
+    {
+    #endif
+    #ifdef _PIC14E
+    Flash_Erase(m_row_addr / 2, (m_row_addr + FLASH_ERASE_SIZE) / 2);
+    Flash_WriteRange(m_row_addr / 2, FLASH_ERASE_SIZE, m_row);
+    #else
+    Flash_Erase(m_row_addr, m_row_addr + FLASH_ERASE_SIZE);
+    Flash_WriteRange(m_row_addr, FLASH_ERASE_SIZE, m_row);
+    #endif
+    #ifdef USE_VERIFY
+        if(flash_matches(m_row_addr, m_row, FLASH_ERASE_SIZE)) break;
+        if(tries == VERIFY_RETRIES)
+        {
+            #ifdef HAS_STATUS_FILE
+            m_status.failures++;
+            #endif
+            m_write_failed = true;
+            break;
+        }
+        #ifdef HAS_STATUS_FILE
+        m_status.retries++;
+        #endif
+    }
+    #endif
+    #ifdef HAS_STATUS_FILE
+    m_status.rows_written++;
+    #endif
+}
+#endif
+
+#ifdef USE_SKIP_SAME
+static void row_write_block(uint24_t address)
+{
+    // Stands in for write_block(). The first time a row is written in a
+    // session it starts blank, as if erased, and blocks are ANDed in just as
+    // flash would program them. commit_row() only erases and rewrites the
+    // row if it differs from flash.
+    uint16_t row = (uint16_t)((address - PROG_REGION_START) / FLASH_ERASE_SIZE);
+    uint8_t  mask = (uint8_t)(1 << (row & 7));
+    uint16_t index = address & ROW_INDEX_MASK;
+    uint8_t  i, data;
+    
+    open_row(address, !(m_erased[row >> 3] & mask));
+    m_erased[row >> 3] |= mask;
+    
+    for(i = 0; i < FLASH_WRITE_SIZE; i++)
+    {
+        data = m_row[index] & m_flash_block[i];
+        if(m_row[index] != data)
+        {
+            m_row[index] = data;
+            m_row_dirty  = true;
+        }
+        index++;
+    }
+}
+#endif
 
 #ifndef SIMPLE_BOOTLOADER
 static uint32_t LBA_to_flash_addr(uint32_t LBA)
@@ -579,6 +2230,7 @@ static uint32_t LBA_to_flash_addr(uint32_t LBA)
 }
 #endif
 
+#if !defined(_18F14K50) && !defined(_18F24K50)
 static uint8_t get_device(void)
 {
     #if defined(_PIC14E)
@@ -619,4 +2271,5 @@ static uint8_t get_device(void)
     if(TABLAT & 0x80) return '4';
     else return '2';
     #endif
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -1,7 +1,7 @@
 /**
  * @file bootloader.h
  * @author John Izzard
- * @date 2024-11-12
+ * @date 2026-10-16
  * 
  * @brief USB uC - USB MSD Bootloader.
  */
@@ -31,6 +31,28 @@
  /**
  * Change Log
  * ----------
+ * File Version 2.2.0 - 2026-10-16
+ * - Added: Bootloader options.
+ * - Added: UF2 block definitions.
+ * - Added: PROG_REGION_END.
+ * - Added: UCLZ compressed image definitions.
+ * - Added: Delta patch definitions.
+ * - Added: Erase on demand option.
+ * - Added: Skip unchanged rows option and STATUS.TXT.
+ * - Added: Skip blank blocks option.
+ * - Added: Block cache option.
+ * - Added: Double buffer option and boot_tasks().
+ * - Added: Erase check option.
+ * - Added: Verify option, retry and failure counts in STATUS.TXT.
+ * - Added: EEPROM queue option, boot_tasks() returns if work is pending.
+ * - Added: Emulated EEPROM option for parts without EEPROM.
+ * - Added: EEPROM mirror option.
+ * - Added: Trimmed PROG_MEM.BIN option.
+ * - Added: PROG_MEM.HEX option.
+ * - Added: PROG_MEM.CRC option.
+ * - Changed: Files are placed by cluster, cluster size is SECT_PER_CLUS.
+ * - Added: FAT12 volume with USE_FAST_MOUNT.
+ *
  * File Version 2.1.1 - 2024-11-12
  * - Changed: MIT License.
  *
@@ -50,7 +72,7 @@
 #ifndef BOOTLOADER_H
 #define BOOTLOADER_H
 
-/* Emulated FAT16 File System
+/* Emulated FAT16 File System (a smaller FAT12 volume with USE_FAST_MOUNT)
              ______________
     0x00000 |              |
             |  BOOT SECT   | 0x200 (512B)
@@ -260,6 +282,7 @@
  */
 
 #include "config.h"
+#include "eeprom.h" // USE_EMU_EEPROM.
 
 // Memory Regions.
 #if defined(_PIC14E)
@@ -405,35 +428,201 @@
 #define HAS_EEPROM
 #endif
 
-// FAT16 File system constants.
+// End of user writable flash (J parts keep the config words in the last page).
+#ifdef __J_PART
+#define PROG_REGION_END CONFIG_PAGE_START
+#else
+#define PROG_REGION_END END_OF_FLASH
+#endif
+
+// Bootloader Options.
+// The bootloader has to fit inside the 8KB boot region, which is nearly full on
+// some parts (PIC16F145X especially), so extra features are off by default.
+//#define USE_UF2        // Uncomment to accept UF2 images as well as Intel HEX files.
+//#define USE_BIN_WRITE  // Uncomment to make PROG_MEM.BIN writable, overwriting it in place programs flash.
+//#define USE_UCLZ       // Uncomment to accept compressed images made with hex_pack.py.
+//#define USE_DELTA      // Uncomment to accept patches made with hex_delta.py against the current firmware.
+//#define USE_ERASE_ON_DEMAND // Uncomment to erase each row just before its first write, instead of all of user flash up front.
+//#define FULL_WIPE           // With USE_ERASE_ON_DEMAND, uncomment to also erase rows the image didn't touch once it's finished.
+//#define USE_SKIP_SAME       // Uncomment to compare rows with flash before programming, unchanged rows aren't erased or rewritten.
+//#define USE_SKIP_BLANK      // Uncomment to skip programming blocks that are all 0xFF (padding).
+//#define USE_BLOCK_CACHE     // Uncomment to cache blocks, so out of order HEX records don't program a block more than once.
+//#define USE_DOUBLE_BUFFER   // Uncomment to write blocks from the main loop, the next USB packet can arrive while the core is stalled.
+//#define USE_ERASE_CHECK     // Uncomment to read rows before erasing them, rows that are already blank aren't erased.
+//#define USE_VERIFY          // Uncomment to read back every write, retrying up to VERIFY_RETRIES times before failing the image.
+//#define USE_TRIM_PROG_MEM   // Uncomment to size PROG_MEM.BIN to the programmed part of flash, instead of all of it.
+//#define USE_PROG_MEM_CRC    // Uncomment to add PROG_MEM.CRC, CRC-32s of user flash, EEPROM and config words so a device can be checked with one read.
+//#define USE_PROG_MEM_HEX    // Uncomment to add PROG_MEM.HEX, user flash, EEPROM and config words as a HEX file that can be copied onto another device.
+//#define USE_EEPROM_QUEUE    // Uncomment to write EEPROM from the main loop, so USB isn't held up by EEPROM write cycles (288 bytes of RAM).
+//#define USE_EEPROM_MIRROR   // Uncomment to keep a copy of EEPROM in RAM, so EEPROM.BIN reads don't go back to EEPROM (256 bytes of RAM).
+// USE_EMU_EEPROM, EEPROM.BIN emulated in flash on parts without EEPROM, is set in eeprom.h so eeprom.c builds the emulation only when it's used.
+
+#define VERIFY_RETRIES 2 // Extra attempts at a write that doesn't read back.
+#define BIN_IDLE_TASKS 20000 // Idle main loop passes before the last row of a PROG_MEM.BIN write is written.
+
+#ifdef SIMPLE_BOOTLOADER // No PROG_MEM.BIN file to write to.
+#undef USE_BIN_WRITE
+#undef USE_PROG_MEM_HEX
+#undef USE_PROG_MEM_CRC
+#undef USE_TRIM_PROG_MEM
+#endif
+
+#ifdef USE_BIN_WRITE // Writes past the end of a trimmed file would go to clusters that aren't PROG_MEM.BIN's.
+#undef USE_TRIM_PROG_MEM
+#endif
+
+// Block cache size, in blocks of _FLASH_WRITE_SIZE, based on the RAM each family has to spare.
+// Each block is only programmed once while records come from at most this many
+// runs of flash in turn, as a linker interleaving psects writes them. With more,
+// a block can be written out before its last record arrives and is programmed
+// again: 3 runs on the PIC16F145X write twice as many blocks.
+#if defined(_PIC14E)
+#define BLOCK_CACHE_SLOTS 2 // 128 bytes.
+#elif defined(__J_PART)
+#define BLOCK_CACHE_SLOTS 8 // 512 bytes.
+#else
+#define BLOCK_CACHE_SLOTS 4 // 64 to 256 bytes.
+#endif
+
+#ifdef USE_SKIP_SAME // Flash has to be kept until each row is compared.
+#define USE_ERASE_ON_DEMAND
+#endif
+
+#ifndef USE_ERASE_ON_DEMAND // Rows are only left untouched with erase on demand.
+#undef FULL_WIPE
+#endif
+
+#if defined(USE_BIN_WRITE) || defined(USE_DELTA) || defined(USE_SKIP_SAME)
+#define USE_ROW_RMW // Read-modify-write of whole erase rows.
+#endif
+
+#ifdef USE_SKIP_SAME // Blocks go through the row buffer, which is written a whole row at a time.
+#undef USE_DOUBLE_BUFFER
+#endif
+
+#if defined(USE_EMU_EEPROM) && !defined(HAS_EEPROM) // eeprom.h has checked the part.
+#define HAS_EEPROM
+#define EEPROM_SIZE EMU_EEPROM_SIZE
+#undef PROG_REGION_END // The log pages aren't erased or programmed with the image.
+#ifdef _PIC14E
+#define PROG_REGION_END (EMU_EEPROM_START * 2)
+#else
+#define PROG_REGION_END EMU_EEPROM_START
+#endif
+#else
+#undef USE_EMU_EEPROM
+#endif
+
+#if !defined(HAS_EEPROM) || defined(USE_EMU_EEPROM) // Emulated EEPROM writes are flash writes.
+#undef USE_EEPROM_QUEUE
+#endif
+
+#if !defined(HAS_EEPROM) || defined(USE_EMU_EEPROM) || defined(_18F14K50) // Emulated EEPROM is already read from RAM, the 14K50 doesn't have the RAM to spare.
+#undef USE_EEPROM_MIRROR
+#endif
+
+#if defined(USE_EEPROM_QUEUE) && defined(_18F14K50)
+#error "USE_EEPROM_QUEUE needs 288 bytes of RAM the PIC18F14K50 doesn't have."
+#endif
+
+#if defined(USE_DOUBLE_BUFFER) || defined(USE_EEPROM_QUEUE) || defined(USE_BIN_WRITE)
+#define HAS_BOOT_TASKS // main() calls boot_tasks().
+#endif
+
+#if (defined(USE_SKIP_SAME) || defined(USE_VERIFY) || defined(USE_DELTA)) && !defined(SIMPLE_BOOTLOADER)
+#define HAS_STATUS_FILE // STATUS.TXT reports on the last programming session.
+#endif
+
+#if defined(USE_PROG_MEM_HEX) || defined(USE_PROG_MEM_CRC) // Config words in PROG_MEM.HEX and PROG_MEM.CRC.
+#if defined(_PIC14E)
+#define CONFIG_WORDS_START (CONFIG_REGION_START + 0x0E) // CONFIG1 and CONFIG2.
+#define CONFIG_WORDS_SIZE  4
+#elif defined(__J_PART)
+#define CONFIG_WORDS_START CONFIG_REGION_START
+#define CONFIG_WORDS_SIZE  8
+#else
+#define CONFIG_WORDS_START CONFIG_REGION_START
+#define CONFIG_WORDS_SIZE  14
+#endif
+#endif
+
+// FAT File system constants.
+// SECT_PER_CLUS and the volume size are in usb_msd_config.h. Each file starts
+// on a cluster, so files are placed by cluster and their sectors follow.
+#include "usb_msd_config.h"
 #define ROOT_ENTRY_COUNT 16
-#define FAT_SIZE 17
+#define CLUSTER_SIZE     (SECT_PER_CLUS * 512UL)
+#define DATA_CLUSTERS    VOL_CLUSTERS
+#define FAT_SIZE         VOL_FAT_SIZE
 
 #define BOOT_SECT_ADDR     0
 #define FAT_SECT_ADDR      1
-#define ROOT_SECT_ADDR     18
-#define DATA_SECT_ADDR     19
+#define ROOT_SECT_ADDR     (FAT_SECT_ADDR + FAT_SIZE)
+#define DATA_SECT_ADDR     (ROOT_SECT_ADDR + 1) // ROOT_ENTRY_COUNT entries fit in one sector.
+#define CLUST_SECT_ADDR(clust) (DATA_SECT_ADDR + ((uint24_t)((clust) - 2) * SECT_PER_CLUS))
+
+#ifdef USE_FAST_MOUNT
+#if DATA_CLUSTERS >= 4085
+#error "Too many clusters for FAT12, use a bigger SECT_PER_CLUS."
+#endif
+#elif DATA_CLUSTERS < 4085 || ((DATA_CLUSTERS + 2) * 2 + 511) / 512 != FAT_SIZE
+#error "FAT16 volume in usb_msd_config.h doesn't match FAT_SIZE."
+#endif
+
+#define ABOUT_CLUST        2
 #ifndef HAS_EEPROM
-#define ABOUT_SECT_ADDR    DATA_SECT_ADDR
-#define PROG_MEM_SECT_ADDR 20
+#define STATUS_CLUST       3
+#define STATUS_ROOT_ENTRY  2 // Root entry of STATUS.TXT without PROG_MEM.BIN, one after with it.
+#else
+#define EEPROM_CLUST       3
+#define STATUS_CLUST       4
+#define STATUS_ROOT_ENTRY  3
+#endif
+#ifdef HAS_STATUS_FILE
+#define CRC_CLUST          (STATUS_CLUST + 1)
+#define CRC_ROOT_ENTRY     (STATUS_ROOT_ENTRY + 1) // Root entry of PROG_MEM.CRC without PROG_MEM.BIN, one after with it.
+#else
+#define CRC_CLUST          STATUS_CLUST
+#define CRC_ROOT_ENTRY     STATUS_ROOT_ENTRY
+#endif
+#ifdef USE_PROG_MEM_CRC
+#define PROG_MEM_CLUST     (CRC_CLUST + 1)
 #else
-#define ABOUT_SECT_ADDR    DATA_SECT_ADDR
-#define EEPROM_SECT_ADDR   20
-#define PROG_MEM_SECT_ADDR 21
+#define PROG_MEM_CLUST     CRC_CLUST
 #endif
 
-#define FILE_CLUSTERS (FILE_SIZE / 512)
+#define FILE_CLUSTERS ((FILE_SIZE + CLUSTER_SIZE - 1) / CLUSTER_SIZE)
+#define FILE_SECTORS  (FILE_SIZE / 512)
 
+#if PROG_MEM_CLUST + FILE_CLUSTERS > DATA_CLUSTERS + 2
+#error "PROG_MEM.BIN doesn't fit on the volume in usb_msd_config.h."
+#endif
+
+#define ABOUT_SECT_ADDR    CLUST_SECT_ADDR(ABOUT_CLUST)
 #ifdef HAS_EEPROM
-#define PROG_MEM_CLUST 4
+#define EEPROM_SECT_ADDR   CLUST_SECT_ADDR(EEPROM_CLUST)
+#endif
+#define STATUS_SECT_ADDR   CLUST_SECT_ADDR(STATUS_CLUST)
+#define CRC_SECT_ADDR      CLUST_SECT_ADDR(CRC_CLUST)
+#define PROG_MEM_SECT_ADDR CLUST_SECT_ADDR(PROG_MEM_CLUST)
+
+#ifdef USE_PROG_MEM_HEX
+#define HEX_CLUST      (PROG_MEM_CLUST + FILE_CLUSTERS) // After the largest PROG_MEM.BIN.
+#define HEX_SECT_ADDR  CLUST_SECT_ADDR(HEX_CLUST)
+#ifdef USE_PROG_MEM_CRC
+#define HEX_ROOT_ENTRY (CRC_ROOT_ENTRY + 2) // Only there with PROG_MEM.BIN, after STATUS.TXT and PROG_MEM.CRC.
 #else
-#define PROG_MEM_CLUST 3
+#define HEX_ROOT_ENTRY (CRC_ROOT_ENTRY + 1)
+#endif
 #endif
 
 // Bootloader State.
 #define BOOT_DUMMY    0
 #define BOOT_LOAD_HEX 1
 #define BOOT_FINISHED 2
+#define BOOT_LOAD_UF2 3
+#define BOOT_LOAD_LZ  4
+#define BOOT_LOAD_DELTA 5
 
 // Hex Parser State.
 #define HEX_START       0
@@ -459,6 +648,81 @@
 #define  ELA_REC  4 // Extended Linear Address Record
 #define  SLA_REC  5 // Start Linear Address Record
 
+// PROG_MEM.HEX record lengths, in characters (":", count, address, type, data, checksum and CRLF).
+#define HEX_REC_BYTES 16
+#define HEX_REC_CHARS (13 + (HEX_REC_BYTES * 2))
+#define HEX_ELA_CHARS 17
+#define HEX_EOF_CHARS 13
+
+// UF2 Block constants.
+#define UF2_MAGIC_START0        0x0A324655UL // "UF2\n"
+#define UF2_MAGIC_START1        0x9E5D5157UL
+#define UF2_MAGIC_END           0x0AB16F30UL
+#define UF2_FLAG_NOT_MAIN_FLASH 0x00000001UL
+#define UF2_FLAG_FAMILY_ID      0x00002000UL // familyID holds the target family instead of the file size.
+#ifdef _PIC14E                               // Family IDs for uf2conv.py -f, not in Microsoft's uf2families.json.
+#define UF2_FAMILY_ID           0x16E14B00UL
+#else
+#define UF2_FAMILY_ID           0x18F14B00UL
+#endif
+#define UF2_DATA_OFFSET         32
+#define UF2_MAX_PAYLOAD         476
+#define UF2_WRITE               0 // uf2_target() results.
+#define UF2_SKIP                1
+#define UF2_BAD                 2
+
+// UCLZ Compressed Image constants (see hex_pack.py).
+// Stream: "UCLZ" followed by tags.
+// 0x00-0x7F: Literal run, (tag + 1) bytes follow.
+// 0x80-0xFD: Match of (tag - 0x80 + LZ_MIN_MATCH) bytes, 16-bit little endian distance follows.
+// 0xFE:      New address, 24-bit little endian address follows.
+// 0xFF:      End of image.
+#define LZ_MAGIC     0x5A4C4355UL // "UCLZ"
+#define LZ_MIN_MATCH 4
+#define LZ_TAG_MATCH 0x80
+#define LZ_TAG_ADDR  0xFE
+#define LZ_TAG_END   0xFF
+
+// UCLZ Decoder State.
+#define LZ_HEADER  0
+#define LZ_TAG     1
+#define LZ_LITERAL 2
+#define LZ_DIST    3
+#define LZ_ADDR    4
+
+// Delta Patch constants (see hex_delta.py).
+// Patch: "UCDP", CRC-32 of the PROG_MEM.BIN it was made against (little endian),
+// followed by records of 24-bit little endian address, length and data.
+// A record with a length of 0 ends the patch.
+#define DELTA_MAGIC 0x50444355UL // "UCDP"
+
+// Delta Patch Parser State.
+#define DELTA_HEADER 0
+#define DELTA_ADDR   1
+#define DELTA_LEN    2
+#define DELTA_DATA   3
+
+// Programming Session Status.
+// STATUS.TXT counts are kept in __persistent RAM, which is only left alone
+// while the bootloader keeps control. They can be read after the reset that
+// follows programming if the button is held through it, or if the image
+// failed and was erased. Once the application has run they can't be trusted.
+#define STATUS_MAGIC 0xC0DE
+
+typedef struct
+{
+    uint16_t magic;        // STATUS_MAGIC once a session has started, the rest is valid.
+    uint16_t rows_written;
+    uint16_t rows_skipped;
+    #ifdef USE_VERIFY
+    uint16_t retries;
+    uint16_t failures;     // Writes that still didn't verify after VERIFY_RETRIES retries.
+    #endif
+    #ifdef USE_DELTA
+    uint16_t patches_rejected; // Patches made against other firmware, since the last image.
+    #endif
+}STATUS_t;
+
 // Volume Labels based on processor.
 #if defined(_PIC14E)
 #define VOLUME_LABEL {'P','I','C','1','6','F','1','4','5','X',' '}
@@ -524,25 +788,50 @@ const BOOT16_t BOOT16 = {
     {0xEB,0x3C,0x90},
     {'M','S','D','O','S','5','.','0'},
     BYTES_PER_BLOCK_LE,
-    1,
+    SECT_PER_CLUS,
     1,
     1,
     ROOT_ENTRY_COUNT,
+    #if VOL_CAPACITY_IN_BLOCKS > 0xFFFF // Too big for TotSec16.
+    0,
+    #else
     VOL_CAPACITY_IN_BLOCKS,
+    #endif
     0xF8,
     FAT_SIZE,
     0,
     0,
     0,
+    #if VOL_CAPACITY_IN_BLOCKS > 0xFFFF
+    VOL_CAPACITY_IN_BLOCKS,
+    #else
     0,
+    #endif
     0,
     0,
     0x29,
     {0x86,0xE8,0xA3,0x56},
     VOLUME_LABEL,
+    #ifdef USE_FAST_MOUNT
+    {'F','A','T','1','2',' ',' ',' '}
+    #else
     {'F','A','T','1','6',' ',' ',' '}
+    #endif
 };
 
+/** UF2 Block Header (first 32 bytes of every 512 byte UF2 block) */
+typedef struct
+{
+    uint32_t magicStart0;
+    uint32_t magicStart1;
+    uint32_t flags;
+    uint32_t targetAddr;
+    uint32_t payloadSize;
+    uint32_t blockNo;
+    uint32_t numBlocks;
+    uint32_t familyID;
+}UF2_HEADER_t;
+
 ///** Directory Entry Structure */
 //typedef struct
 //{
@@ -571,11 +860,69 @@ typedef struct
     #if defined(HAS_EEPROM)
     DIR_ENTRY_t FILE3;
     #endif
+    #if defined(HAS_STATUS_FILE)
+    DIR_ENTRY_t STATUS;
+    #endif
+    #if defined(USE_PROG_MEM_CRC)
+    DIR_ENTRY_t CRC;
+    #endif
+    #if defined(USE_PROG_MEM_HEX)
+    DIR_ENTRY_t HEX;
+    #endif
     #endif
 }ROOT_DIR_t;
 
 const uint8_t aboutFile[] = "<html><script>window.location=\"https://github.com/johnnydrazzi/USB-uC\";</script></html>";
 
+#if defined(HAS_STATUS_FILE)
+// Counts are filled in by generate_status().
+const uint8_t statusFile[] =
+    #ifdef USE_SKIP_SAME
+    "Rows written: 00000\r\nRows skipped: 00000\r\n"
+    #endif
+    #ifdef USE_VERIFY
+    "Write retries: 00000\r\nWrite failures: 00000\r\n"
+    #endif
+    #ifdef USE_DELTA
+    "Patches rejected: 00000\r\n"
+    #endif
+    ;
+#ifdef USE_SKIP_SAME
+#define STATUS_ROWS_LEN 42
+#else
+#define STATUS_ROWS_LEN 0
+#endif
+#ifdef USE_VERIFY
+#define STATUS_VERIFY_LEN 45
+#else
+#define STATUS_VERIFY_LEN 0
+#endif
+#define STATUS_WRITTEN_POS  14
+#define STATUS_SKIPPED_POS  35
+#define STATUS_RETRIES_POS  (STATUS_ROWS_LEN + 15)
+#define STATUS_FAILURES_POS (STATUS_ROWS_LEN + 38)
+#define STATUS_REJECTED_POS (STATUS_ROWS_LEN + STATUS_VERIFY_LEN + 18)
+#endif
+
+#if defined(USE_PROG_MEM_CRC)
+// Values are filled in by generate_crc(), in hex.
+const uint8_t crcFile[] =
+    "Flash CRC-32:  00000000\r\n"
+    "Flash length:  00000000\r\n"
+    #ifdef HAS_EEPROM
+    "EEPROM CRC-32: 00000000\r\n"
+    #endif
+    "Config CRC-32: 00000000\r\n";
+#define CRC_FLASH_POS  15
+#define CRC_LENGTH_POS (25 + 15)
+#ifdef HAS_EEPROM
+#define CRC_EEPROM_POS (50 + 15)
+#define CRC_CONFIG_POS (75 + 15)
+#else
+#define CRC_CONFIG_POS (50 + 15)
+#endif
+#endif
+
 /** Volume Root Entry */
 const ROOT_DIR_t ROOT =
 {
@@ -585,7 +932,16 @@ const ROOT_DIR_t ROOT =
     #if defined(HAS_EEPROM)
     {'E','E','P','R','O','M',' ',' ','B','I','N'},
     #endif
-    {'P','R','O','G','_','M','E','M','B','I','N'}
+    {'P','R','O','G','_','M','E','M','B','I','N'},
+    #if defined(HAS_STATUS_FILE)
+    {'S','T','A','T','U','S',' ',' ','T','X','T'},
+    #endif
+    #if defined(USE_PROG_MEM_CRC)
+    {'P','R','O','G','_','M','E','M','C','R','C'},
+    #endif
+    #if defined(USE_PROG_MEM_HEX)
+    {'P','R','O','G','_','M','E','M','H','E','X'},
+    #endif
     #endif
 };
 
@@ -593,5 +949,8 @@ extern bool g_boot_reset;
 
 void boot_process_read(void);
 void boot_process_write(void);
+#ifdef HAS_BOOT_TASKS
+bool boot_tasks(void);
+#endif
 
 #endif /* BOOTLOADER_H */
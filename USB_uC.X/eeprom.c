@@ -1,7 +1,7 @@
 /**
  * @file eeprom.c
  * @author John Izzard
- * @date 2024-11-12
+ * @date 2026-10-16
  * 
  * @brief EEPROM Library.
  */
@@ -31,6 +31,13 @@
 /**
  * Change Log
  * ----------
+ * File Version 2.1.0 - 2026-10-16
+ * - Added: EEPROM_Update, only writes bytes that differ.
+ * - Added: EEPROM_WriteStart and EEPROM_Busy, for writes that don't block.
+ * - Added: Emulated EEPROM in flash for PIC16F145X and J parts, which have no
+ *          data EEPROM (USE_EMU_EEPROM in eeprom.h).
+ * - Added: EEPROM_ReadBytes, reads a run of bytes with one address setup.
+ *
  * File Version 2.0.1 - 2024-11-12
  * - Changed: MIT License.
  *
@@ -46,6 +53,8 @@
 
 #include <xc.h>
 #include <stdint.h>
+#include "eeprom.h"
+#include "flash.h"
 
 #ifdef _18F46K80
 void EEPROM_Write(uint16_t address,uint8_t data){
@@ -77,6 +86,44 @@ uint8_t EEPROM_Read(uint16_t address){
     
     return EEDATA;
 }
+void EEPROM_Update(uint16_t address,uint8_t data){
+    if(EEPROM_Read(address) != data) EEPROM_Write(address, data); // Skip the write cycle if it's already there.
+}
+void EEPROM_WriteStart(uint16_t address,uint8_t data){
+    // Same as EEPROM_Write, but doesn't wait for the write to finish.
+    EEADRH = address>>8;
+    EEADR = address;
+    EEDATA = data;
+    
+    EECON1bits.EEPGD = 0;
+    EECON1bits.CFGS = 0;
+    EECON1bits.WREN = 1;
+    
+    EECON2 = 0x55;
+    EECON2 = 0x0AA;
+    EECON1bits.WR = 1;
+    
+    EECON1bits.WREN = 0; // Doesn't affect the write in progress.
+}
+uint8_t EEPROM_Busy(void){
+    return EECON1bits.WR;
+}
+void EEPROM_ReadBytes(uint16_t address,uint16_t bytes,uint8_t *array){
+    // EEPGD and CFGS are set once, only the address is stepped between reads.
+    EEADRH = address>>8;
+    EEADR = address;
+    
+    EECON1bits.EEPGD = 0;
+    EECON1bits.CFGS = 0;
+    while(bytes){
+        EECON1bits.RD = 1;
+        asm("NOP");
+        *array++ = EEDATA;
+        bytes--;
+        EEADR++;
+        if(EEADR == 0) EEADRH++;
+    }
+}
 #endif
 
 #if defined(_18F4550_FAMILY_)||defined(_18F24K50)||defined(_18F25K50)||defined(_18F45K50)
@@ -105,6 +152,41 @@ uint8_t EEPROM_Read(uint8_t address){
     
     return EEDATA;
 }
+void EEPROM_Update(uint8_t address,uint8_t data){
+    if(EEPROM_Read(address) != data) EEPROM_Write(address, data); // Skip the write cycle if it's already there.
+}
+void EEPROM_WriteStart(uint8_t address,uint8_t data){
+    // Same as EEPROM_Write, but doesn't wait for the write to finish.
+    EEADR = address;
+    EEDATA = data;
+    
+    EECON1bits.EEPGD = 0;
+    EECON1bits.CFGS = 0;
+    EECON1bits.WREN = 1;
+    
+    EECON2 = 0x55;
+    EECON2 = 0x0AA;
+    EECON1bits.WR = 1;
+    
+    EECON1bits.WREN = 0; // Doesn't affect the write in progress.
+}
+uint8_t EEPROM_Busy(void){
+    return EECON1bits.WR;
+}
+void EEPROM_ReadBytes(uint8_t address,uint16_t bytes,uint8_t *array){
+    // EEPGD and CFGS are set once, only the address is stepped between reads.
+    EEADR = address;
+    
+    EECON1bits.EEPGD = 0;
+    EECON1bits.CFGS = 0;
+    while(bytes){
+        EECON1bits.RD = 1;
+        asm("NOP");
+        *array++ = EEDATA;
+        bytes--;
+        EEADR++;
+    }
+}
 #endif
 
 #if defined(_18F14K50)
@@ -133,4 +215,162 @@ uint8_t EEPROM_Read(uint8_t address){
     
     return EEDATA;
 }
-#endif
\ No newline at end of file
+void EEPROM_Update(uint8_t address,uint8_t data){
+    if(EEPROM_Read(address) != data) EEPROM_Write(address, data); // Skip the write cycle if it's already there.
+}
+void EEPROM_WriteStart(uint8_t address,uint8_t data){
+    // Same as EEPROM_Write, but doesn't wait for the write to finish.
+    EEADR = address;
+    EEDATA = data;
+    
+    EECON1bits.EEPGD = 0;
+    EECON1bits.CFGS = 0;
+    EECON1bits.WREN = 1;
+    
+    EECON2 = 0x55;
+    EECON2 = 0x0AA;
+    EECON1bits.WR = 1;
+    
+    EECON1bits.WREN = 0; // Doesn't affect the write in progress.
+}
+uint8_t EEPROM_Busy(void){
+    return EECON1bits.WR;
+}
+void EEPROM_ReadBytes(uint8_t address,uint16_t bytes,uint8_t *array){
+    // EEPGD and CFGS are set once, only the address is stepped between reads.
+    EEADR = address;
+    
+    EECON1bits.EEPGD = 0;
+    EECON1bits.CFGS = 0;
+    while(bytes){
+        EECON1bits.RD = 1;
+        asm("NOP");
+        *array++ = EEDATA;
+        bytes--;
+        EEADR++;
+    }
+}
+#endif
+
+#ifdef USE_EMU_EEPROM
+// Each record is one flash word, the EEPROM address in the high byte and the
+// data in the low byte. The first word of the active page is its header, the
+// number of compactions so far mod 3 (0 to 2), and the records follow it in
+// the order they were written, so a byte's latest record is the last one for
+// its address. m_emu_data holds the result of reading the log, reads never go
+// back to flash.
+#if defined(_PIC14E)
+#define EMU_WORD  1      // Flash addresses per word.
+#define EMU_BLANK 0x3FFF
+#define EMU_BLOCK (_FLASH_WRITE_SIZE * 2) // Bytes per write block.
+typedef uint16_t emu_addr_t;
+#else
+#define EMU_WORD  2
+#define EMU_BLANK 0xFFFF
+#define EMU_BLOCK _FLASH_WRITE_SIZE
+typedef uint24_t emu_addr_t;
+#endif
+#define EMU_RECORDS (EMU_PAGE_SIZE / EMU_WORD) // Words per page, including the header.
+
+static uint8_t    m_emu_data[EMU_EEPROM_SIZE];
+static emu_addr_t m_emu_page;     // Start of the active page, 0 if there isn't one yet.
+static uint16_t   m_emu_next = 0; // Next free word in the active page, 0 until the log is read.
+static uint8_t    m_emu_seq;      // Header of the active page.
+
+#define EMU_NEXT_SEQ(seq) (((seq) == 2) ? 0 : (seq) + 1)
+
+static uint16_t emu_read_word(emu_addr_t addr){
+    uint8_t word[2];
+    
+    Flash_ReadBytes(addr, 2, word);
+    return word[0] | ((uint16_t)word[1] << 8);
+}
+static void emu_load(void){
+    emu_addr_t page;
+    uint16_t word;
+    uint16_t i;
+    
+    for(i=0;i<EMU_EEPROM_SIZE;i++) m_emu_data[i] = 0xFF;
+    m_emu_page = 0;
+    m_emu_next = EMU_RECORDS; // No active page, the first write starts one.
+    
+    // Both pages only have a header if a compaction was cut short after the
+    // new page's header was written and before the old page was erased. The
+    // new page is the one whose header is one on from the other's, it also
+    // holds the write that started the compaction.
+    for(page=EMU_EEPROM_START;page<EMU_EEPROM_START+(EMU_PAGE_SIZE*2);page+=EMU_PAGE_SIZE){
+        word = emu_read_word(page);
+        if(word > 2) continue;
+        if(m_emu_page && word != EMU_NEXT_SEQ(m_emu_seq)) continue; // The first page is the newer one.
+        m_emu_page = page;
+        m_emu_seq = (uint8_t)word;
+    }
+    if(m_emu_page == 0) return;
+    for(m_emu_next=1;m_emu_next<EMU_RECORDS;m_emu_next++){
+        word = emu_read_word(m_emu_page + (m_emu_next * EMU_WORD));
+        if(word == EMU_BLANK) break;
+        if((word >> 8) < EMU_EEPROM_SIZE) m_emu_data[word >> 8] = (uint8_t)word;
+    }
+}
+static void emu_compact(void){
+    // Copies the bytes that aren't 0xFF into the other page, then erases the
+    // old one. Records are gathered a write block at a time and programmed
+    // with Flash_WriteRange. The header is written last, so the new page only
+    // counts once it's complete, and it's one on from the old page's header.
+    emu_addr_t page = EMU_EEPROM_START;
+    uint8_t block[EMU_BLOCK];
+    uint8_t n = 2; // The header word is left blank.
+    uint16_t i;
+    
+    if(m_emu_page == EMU_EEPROM_START) page += EMU_PAGE_SIZE;
+    // The other page was erased when it was last retired, so it's only erased
+    // again if a compaction was cut short.
+    Flash_EraseUsed(page, page + EMU_PAGE_SIZE);
+    block[0] = 0xFF;
+    block[1] = 0xFF;
+    m_emu_next = 1;
+    for(i=0;i<EMU_EEPROM_SIZE;i++){
+        if(m_emu_data[i] == 0xFF) continue;
+        block[n++] = m_emu_data[i];
+        block[n++] = (uint8_t)i;
+        m_emu_next++;
+        if(n == EMU_BLOCK){
+            Flash_WriteRange(page + ((m_emu_next - (EMU_BLOCK / 2)) * EMU_WORD), EMU_BLOCK, block);
+            n = 0;
+        }
+    }
+    if(n) Flash_WriteRange(page + ((m_emu_next - (n / 2)) * EMU_WORD), n, block);
+    m_emu_seq = m_emu_page ? EMU_NEXT_SEQ(m_emu_seq) : 0;
+    Flash_WriteWord(page, m_emu_seq);
+    if(m_emu_page) Flash_Erase(m_emu_page, m_emu_page + EMU_PAGE_SIZE);
+    m_emu_page = page;
+}
+void EEPROM_Write(uint8_t address,uint8_t data){
+    uint16_t record = ((uint16_t)address << 8) | data;
+    
+    if(m_emu_next == 0) emu_load();
+#if EMU_EEPROM_SIZE < 256
+    if(address >= EMU_EEPROM_SIZE) return;
+#endif
+    m_emu_data[address] = data;
+    // A record that would read as blank can't be logged, compacting drops it.
+    if(m_emu_next < EMU_RECORDS && record != EMU_BLANK){
+        Flash_WriteWord(m_emu_page + (m_emu_next * EMU_WORD), record);
+        m_emu_next++;
+    }
+    else emu_compact();
+}
+uint8_t EEPROM_Read(uint8_t address){
+    if(m_emu_next == 0) emu_load();
+#if EMU_EEPROM_SIZE < 256
+    if(address >= EMU_EEPROM_SIZE) return 0xFF;
+#endif
+    return m_emu_data[address];
+}
+void EEPROM_Update(uint8_t address,uint8_t data){
+    if(EEPROM_Read(address) != data) EEPROM_Write(address, data); // Skip the log record if it's already there.
+}
+void EEPROM_ReadBytes(uint8_t address,uint16_t bytes,uint8_t *array){
+    while(bytes--) *array++ = EEPROM_Read(address++);
+}
+#endif
@@ -1,7 +1,7 @@
 /**
  * @file flash.c
  * @author John Izzard
- * @date 2024-11-12
+ * @date 2026-10-16
  * 
  * @brief Flash Library.
  */
@@ -31,6 +31,15 @@
 /**
  * Change Log
  * ----------
+ * File Version 1.1.0 - 2026-10-16
+ * - Changed: Flash_ReadBytes loads the address once and steps through it,
+ *            instead of reloading it for every word.
+ * - Added: Flash_WriteRange, programs any address range with one register
+ *          setup, a block at a time.
+ * - Added: Flash_EraseUsed, skips rows that are already blank.
+ * - Added: Flash_WriteWord, programs a single word (PIC16F145X and J parts).
+ * - Added: Flash_UsedEnd, finds the end of the programmed part of a range.
+ *
  * File Version 1.0.1 - 2024-11-12
  * - Changed: MIT License.
  *
@@ -65,10 +74,9 @@
 #if defined(_PIC14)||defined(_PIC14E) 
 void Flash_ReadBytes(uint16_t start_addr, uint16_t bytes, uint8_t *flash_array){
     _EECON1 = 0x80;
+    _EEADRH = (uint8_t)(start_addr>>8);
+    _EEADR = (uint8_t)(start_addr);
     while(bytes){
-        _EEADRH = (uint8_t)(start_addr>>8);
-        _EEADR = (uint8_t)(start_addr);
-        
         _EECON1bits.RD = 1;
         NOP();
         NOP();
@@ -79,9 +87,9 @@ void Flash_ReadBytes(uint16_t start_addr, uint16_t bytes, uint8_t *flash_array){
         
         *flash_array++ = _EEDATH;
         bytes--;
-        if(bytes == 0) break;
         
-        start_addr++;
+        _EEADR++;
+        if(_EEADR == 0) _EEADRH++;
     }
 }
 void Flash_Erase(uint16_t start_addr, uint16_t end_addr){
@@ -99,6 +107,48 @@ void Flash_Erase(uint16_t start_addr, uint16_t end_addr){
     }
     _EECON1bits.WREN = 0;
 }
+uint16_t Flash_EraseUsed(uint16_t start_addr, uint16_t end_addr){
+    // Same as Flash_Erase, but each row is read first and only erased if it
+    // isn't blank (all 0x3FFF). Returns the number of rows erased.
+    uint16_t erased = 0;
+    uint8_t i;
+    
+    while(start_addr<end_addr){
+        _EECON1 = 0x80;
+        _EEADRH = (uint8_t)(start_addr>>8);
+        _EEADR = (uint8_t)(start_addr);
+        for(i=0;i<_FLASH_ERASE_SIZE;i++){
+            _EECON1bits.RD = 1;
+            NOP();
+            NOP();
+            if(_EEDATA != 0xFF || _EEDATH != 0x3F) break;
+            _EEADR++; // Rows are aligned, so no carry into _EEADRH.
+        }
+        if(i != _FLASH_ERASE_SIZE){
+            Flash_Erase(start_addr, start_addr + _FLASH_ERASE_SIZE);
+            erased++;
+        }
+        start_addr += _FLASH_ERASE_SIZE;
+    }
+    return erased;
+}
+uint16_t Flash_UsedEnd(uint16_t start_addr, uint16_t end_addr){
+    // Reads backwards from end_addr, returns the address after the last word
+    // that isn't blank (0x3FFF), or start_addr if they all are.
+    _EECON1 = 0x80;
+    _EEADRH = (uint8_t)((end_addr-1)>>8);
+    _EEADR = (uint8_t)(end_addr-1);
+    while(end_addr>start_addr){
+        _EECON1bits.RD = 1;
+        NOP();
+        NOP();
+        if(_EEDATA != 0xFF || _EEDATH != 0x3F) break;
+        if(_EEADR == 0) _EEADRH--;
+        _EEADR--;
+        end_addr--;
+    }
+    return end_addr;
+}
 void Flash_EraseWriteBlock(uint16_t start_addr, uint8_t *flash_array){
 #if _FLASH_ERASE_SIZE>_FLASH_WRITE_SIZE
     uint8_t i;
@@ -162,25 +212,68 @@ void Flash_WriteBlock(uint16_t start_addr, uint8_t *flash_array){
     _EECON1bits.WREN = 0;
 #endif
 }
+void Flash_WriteRange(uint16_t start_addr, uint16_t bytes, uint8_t *flash_array){
+    // Programs bytes (whole words) from flash_array into erased flash from
+    // start_addr, which needn't be row aligned. The address is set once and
+    // stepped through the range, each row is written once its last latch, or
+    // the last word of the range, is loaded. Latches left out are at 0x3FFF,
+    // which doesn't change flash.
+    uint8_t i = (uint8_t)start_addr & (_FLASH_WRITE_SIZE-1);
+    
+    _EECON1 = 0xA4; // EEPGD = 1, CFGS = 0, FREE = 0, LWLO = 1, WREN = 1
+    _EEADRH = (uint8_t)(start_addr>>8);
+    _EEADR = (uint8_t)(start_addr);
+    while(bytes){
+        _EEDATA = *flash_array++;
+        _EEDATH = *flash_array++;
+        bytes -= 2;
+        if(++i == _FLASH_WRITE_SIZE || bytes == 0){
+            _EECON1bits.LWLO = 0;
+            _EECON2 = 0x55;
+            _EECON2 = 0xAA;
+            _EECON1bits.WR = 1;
+            NOP();
+            NOP();
+            _EECON1bits.LWLO = 1;
+            i = 0;
+        }
+        else{
+            _EECON2 = 0x55;
+            _EECON2 = 0xAA;
+            _EECON1bits.WR = 1;
+            NOP();
+            NOP();
+        }
+        _EEADR++;
+        if(i == 0 && _EEADR == 0) _EEADRH++; // Rows are aligned, only the step into the next one can carry.
+    }
+    _EECON1bits.WREN = 0;
+}
+void Flash_WriteWord(uint16_t addr, uint16_t data){
+    // The other latches in the row are left at 0x3FFF, which doesn't change
+    // words that are already programmed.
+    _EECON1 = 0x84; // EEPGD = 1, CFGS = 0, LWLO = 0, WREN = 1
+    _EEADRH = (uint8_t)(addr>>8);
+    _EEADR = (uint8_t)(addr);
+    _EEDATA = (uint8_t)(data);
+    _EEDATH = (uint8_t)(data>>8);
+    _EECON2 = 0x55;
+    _EECON2 = 0xAA;
+    _EECON1bits.WR = 1;
+    NOP();
+    NOP();
+    _EECON1bits.WREN = 0;
+}
 #elif defined(_PIC18)
 void Flash_ReadBytes(uint24_t start_addr, uint24_t bytes, uint8_t *flash_array){
     EECON1 = 0x80; // EEPGD = 1 and CFGS = 0
+    TBLPTRU = (uint8_t)(start_addr>>16);
+    TBLPTRH = (uint8_t)(start_addr>>8);
+    TBLPTRL = (uint8_t)(start_addr);
     while(bytes){
-        TBLPTRU = (uint8_t)(start_addr>>16);
-        TBLPTRH = (uint8_t)(start_addr>>8);
-        TBLPTRL = (uint8_t)(start_addr);
-        
-        asm("TBLRDPOSTINC");
-        *flash_array++ = TABLAT;
-        bytes--;
-        if(bytes == 0) break;
-        
-        asm("TBLRDPOSTINC");
+        asm("TBLRDPOSTINC"); // TBLPTR steps on by itself.
         *flash_array++ = TABLAT;
         bytes--;
-        if(bytes == 0) break;
-        
-        start_addr+=2;
     }
 }
 void Flash_Erase(uint24_t start_addr, uint24_t end_addr){
@@ -197,6 +290,43 @@ void Flash_Erase(uint24_t start_addr, uint24_t end_addr){
     }
     EECON1bits.WREN = 0;
 }
+uint16_t Flash_EraseUsed(uint24_t start_addr, uint24_t end_addr){
+    // Same as Flash_Erase, but each row is read first and only erased if it
+    // isn't blank (all 0xFF). Returns the number of rows erased.
+    uint16_t erased = 0;
+    uint16_t i;
+    
+    while(start_addr<end_addr){
+        EECON1 = 0x80; // EEPGD = 1 and CFGS = 0
+        TBLPTRU = (uint8_t)(start_addr>>16);
+        TBLPTRH = (uint8_t)(start_addr>>8);
+        TBLPTRL = (uint8_t)(start_addr);
+        for(i=0;i<_FLASH_ERASE_SIZE;i++){
+            asm("TBLRDPOSTINC");
+            if(TABLAT != 0xFF) break;
+        }
+        if(i != _FLASH_ERASE_SIZE){
+            Flash_Erase(start_addr, start_addr + _FLASH_ERASE_SIZE);
+            erased++;
+        }
+        start_addr += _FLASH_ERASE_SIZE;
+    }
+    return erased;
+}
+uint24_t Flash_UsedEnd(uint24_t start_addr, uint24_t end_addr){
+    // Reads backwards from end_addr, returns the address after the last byte
+    // that isn't blank (0xFF), or start_addr if they all are.
+    EECON1 = 0x80; // EEPGD = 1 and CFGS = 0
+    TBLPTRU = (uint8_t)((end_addr-1)>>16);
+    TBLPTRH = (uint8_t)((end_addr-1)>>8);
+    TBLPTRL = (uint8_t)(end_addr-1);
+    while(end_addr>start_addr){
+        asm("TBLRDPOSTDEC");
+        if(TABLAT != 0xFF) break;
+        end_addr--;
+    }
+    return end_addr;
+}
 void Flash_EraseWriteBlock(uint24_t start_addr, uint8_t *flash_array){
 #if _FLASH_ERASE_SIZE>_FLASH_WRITE_SIZE
     uint8_t i;
@@ -230,6 +360,59 @@ void Flash_WriteBlock(uint24_t start_addr, uint8_t *flash_array){
     EECON1bits.WR = 1;
     EECON1bits.WREN = 0;
 }
+void Flash_WriteRange(uint24_t start_addr, uint24_t bytes, uint8_t *flash_array){
+    // Programs bytes from flash_array into erased flash from start_addr, which
+    // needn't be block aligned. EECON1 and TBLPTR are set once, TBLPTR steps
+    // through the range and each block is written as soon as its holding
+    // registers are loaded. Bytes outside the range are loaded as 0xFF, which
+    // doesn't change flash.
+    uint8_t i = (uint8_t)start_addr & (_FLASH_WRITE_SIZE-1);
+    
+    if(bytes == 0) return;
+    start_addr -= i;
+    EECON1 = 0x84; // EEPGD = 1, CFGS = 0, WREN = 1
+    TBLPTRU = (uint8_t)(start_addr>>16);
+    TBLPTRH = (uint8_t)(start_addr>>8);
+    TBLPTRL = (uint8_t)(start_addr);
+    asm("TBLRDPOSTDEC"); // TBLWT+* steps back in, and leaves TBLPTR inside the block for WR.
+    for(start_addr=i;start_addr;start_addr--){
+        TABLAT = 0xFF;
+        asm("TBLWTPREINC");
+    }
+    while(1){
+        TABLAT = *flash_array++;
+        asm("TBLWTPREINC");
+        bytes--;
+        if(++i == _FLASH_WRITE_SIZE || bytes == 0){
+            for(;i<_FLASH_WRITE_SIZE;i++){ // Range ends part way through the block.
+                TABLAT = 0xFF;
+                asm("TBLWTPREINC");
+            }
+            EECON2 = 0x55;
+            EECON2 = 0xAA;
+            EECON1bits.WR = 1;
+            if(bytes == 0) break;
+            i = 0;
+        }
+    }
+    EECON1bits.WREN = 0;
+}
+#ifdef __J_PART
+void Flash_WriteWord(uint24_t addr, uint16_t data){
+    TBLPTRU = (uint8_t)(addr>>16);
+    TBLPTRH = (uint8_t)(addr>>8);
+    TBLPTRL = (uint8_t)(addr);
+    TABLAT = (uint8_t)(data);
+    asm("TBLWTPOSTINC");
+    TABLAT = (uint8_t)(data>>8);
+    asm("TBLWT*");
+    EECON1 = 0x24; // WPROG = 1, WREN = 1
+    EECON2 = 0x55;
+    EECON2 = 0xAA;
+    EECON1bits.WR = 1;
+    EECON1 = 0;
+}
+#endif
 #else
 #error FLASH - DEVICE NOT YET SUPPORTED
 #endif
\ No newline at end of file
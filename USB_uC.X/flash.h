@@ -1,7 +1,7 @@
 /**
  * @file flash.h
  * @author John Izzard
- * @date 2024-11-12
+ * @date 2026-10-16
  * 
  * @brief Flash Library.
  */
@@ -31,6 +31,12 @@
 /**
  * Change Log
  * ----------
+ * File Version 1.1.0 - 2026-10-16
+ * - Added: Flash_WriteRange.
+ * - Added: Flash_EraseUsed.
+ * - Added: Flash_WriteWord (PIC16F145X and J parts).
+ * - Added: Flash_UsedEnd.
+ *
  * File Version 1.0.1 - 2024-11-12
  * - Changed: MIT License.
  *
@@ -46,14 +52,24 @@
 #ifndef _PIC18 // Non-PIC18
 void Flash_ReadBytes(uint16_t start_addr, uint16_t bytes, uint8_t *flash_array);
 void Flash_Erase(uint16_t start_addr, uint16_t end_addr);
+uint16_t Flash_EraseUsed(uint16_t start_addr, uint16_t end_addr);
+uint16_t Flash_UsedEnd(uint16_t start_addr, uint16_t end_addr);
 void Flash_EraseWriteBlock(uint16_t start_addr, uint8_t *flash_array);
 void Flash_WriteBlock(uint16_t start_addr, uint8_t *flash_array);
+void Flash_WriteRange(uint16_t start_addr, uint16_t bytes, uint8_t *flash_array);
+void Flash_WriteWord(uint16_t addr, uint16_t data);
 #else
 void Flash_ReadBytes(uint24_t start_addr, uint24_t bytes, uint8_t *flash_array);
 void Flash_Erase(uint24_t start_addr, uint24_t end_addr);
+uint16_t Flash_EraseUsed(uint24_t start_addr, uint24_t end_addr);
+uint24_t Flash_UsedEnd(uint24_t start_addr, uint24_t end_addr);
 void Flash_EraseWriteBlock(uint24_t start_addr, uint8_t *flash_array);
 void Flash_WriteBlock(uint24_t start_addr, uint8_t *flash_array);
+void Flash_WriteRange(uint24_t start_addr, uint24_t bytes, uint8_t *flash_array);
 void Flash_WriteConfigBlock(uint8_t *flash_array);
+#ifdef __J_PART
+void Flash_WriteWord(uint24_t addr, uint16_t data);
+#endif
 #endif /* _PIC18 */
 
 #endif /* FLASH_H */
\ No newline at end of file
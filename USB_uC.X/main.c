@@ -1,7 +1,7 @@
 /**
  * @file main.c
  * @author John Izzard
- * @date 2024-11-12
+ * @date 2026-10-16
  * 
  * @brief Main C file.
  */
@@ -31,6 +31,10 @@
 /**
  * Change Log
  * ----------
+ * File Version 2.2.0 - 2026-10-16
+ * - Added: boot_tasks() in the USB loops (HAS_BOOT_TASKS), the reset waits
+ *          for it to finish.
+ *
  * File Version 2.1.3 - 2024-11-12
  * - Changed: MIT License.
  *
@@ -116,6 +120,9 @@ void main(void)
         {
             usb_tasks();
             msd_tasks();
+            #ifdef HAS_BOOT_TASKS
+            boot_tasks();
+            #endif
             if(g_boot_reset)   goto delayed_reset;
             if(BUTTON_PRESSED && user_firmware) goto button_reset;
         }
@@ -135,6 +142,9 @@ void main(void)
     {
         usb_tasks();
         msd_tasks();
+        #ifdef HAS_BOOT_TASKS
+        boot_tasks();
+        #endif
     }
     
     // Ready to leave the bootloader.
@@ -146,6 +156,9 @@ void main(void)
     {
         usb_tasks();
         msd_tasks();
+        #ifdef HAS_BOOT_TASKS
+        if(boot_tasks()) continue; // Queued writes finish before the reset.
+        #endif
         m_delay_cnt++;
         __delay_us(500);
         if(m_delay_cnt == 200) break;
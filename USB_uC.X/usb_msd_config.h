@@ -1,7 +1,7 @@
 /**
  * @file usb_msd_config.h
  * @author John Izzard
- * @date 2024-11-12
+ * @date 2026-10-16
  * 
  * @brief USB uC - <i>Mass Storage Class</i> user settings.
  */
@@ -31,6 +31,10 @@
 /**
  * Change Log
  * ----------
+ * File Version 1.1.0 - 2026-10-16
+ * - Added: SECT_PER_CLUS, capacity is worked out from it.
+ * - Added: USE_FAST_MOUNT, a FAT12 volume sized to the part.
+ *
  * File Version 1.0.2 - 2024-11-12
  * - Changed: MIT License.
  *
@@ -60,14 +64,34 @@
 //#define USE_READ_CAPACITY   // if not defined use the constant defines for capacity below. 
 
 // CAPACITY
+// The bootloader's volume is a boot sector, the FAT and one root sector,
+// followed by VOL_CLUSTERS clusters of SECT_PER_CLUS blocks.
+// FAT16 needs 4085 clusters or more, so the volume grows with the cluster:
+// SECT_PER_CLUS 1, 2, 4, 8, 16, 32 or 64 gives 2, 4, 8, 16, 32, 64 or 128MB.
+// The USE_FAST_MOUNT volume is 7 times FILE_SIZE (58KB to 844KB) whatever
+// SECT_PER_CLUS is, rounded up to a whole cluster.
+#define SECT_PER_CLUS 1 // 1, 2, 4, 8, 16, 32 or 64. Bigger clusters make shorter FAT chains and larger host reads.
+//#define USE_FAST_MOUNT  // Uncomment for the smallest FAT12 volume that fits the part, hosts read less when mounting the drive.
+
+#ifdef USE_FAST_MOUNT
+// 7 times the largest PROG_MEM.BIN (FILE_SIZE in bootloader.h), room for
+// PROG_MEM.BIN, PROG_MEM.HEX and a HEX file of the whole user region being
+// copied on (a HEX file is under 3 times the binary).
+#define VOL_CLUSTERS ((7UL * FILE_SIZE + (512UL * SECT_PER_CLUS) - 1) / (512UL * SECT_PER_CLUS)) // Under 4085, so FAT12.
+#define VOL_FAT_SIZE ((((VOL_CLUSTERS + 2) * 3 + 1) / 2 + 511) / 512) // 1.5 bytes an entry.
+#else
+#define VOL_CLUSTERS 4096UL // FAT16 needs at least 4085.
+#define VOL_FAT_SIZE 17     // ((VOL_CLUSTERS + 2) * 2 + 511) / 512
+#endif
+
 #define BYTES_PER_BLOCK_LE 0x200 // 512
 #define BYTES_PER_BLOCK_BE 0x00020000UL // Big-endian version
 
-#define VOL_CAPACITY_IN_BYTES  0x202600UL // 2106880B (2MB + 19 * 512)
-#define VOL_CAPACITY_IN_BLOCKS 0x1013     // 4115 Blocks
+#define VOL_CAPACITY_IN_BLOCKS (2 + VOL_FAT_SIZE + (VOL_CLUSTERS * SECT_PER_CLUS)) // 4115 Blocks with 1 block FAT16 clusters
+#define VOL_CAPACITY_IN_BYTES  (VOL_CAPACITY_IN_BLOCKS * 512)                       // 2106880B (2MB + 19 * 512) with 1 block FAT16 clusters
 
-#define LAST_BLOCK_LE 0x1012 // 4114 (VOL_CAPACITY_IN_BLOCKS - 1)
-#define LAST_BLOCK_BE 0x12100000UL // Big-endian version
+#define LAST_BLOCK_LE (VOL_CAPACITY_IN_BLOCKS - 1)
+#define LAST_BLOCK_BE (((LAST_BLOCK_LE & 0xFF) << 24) | ((LAST_BLOCK_LE & 0xFF00) << 8) | ((LAST_BLOCK_LE >> 8) & 0xFF00) | (LAST_BLOCK_LE >> 24)) // Big-endian version
 
 // MSD Endpoint HAL
 #define MSD_EP      EP1
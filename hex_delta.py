@@ -0,0 +1,114 @@
+"""
+This python script makes a delta patch for bootloaders built with USE_DELTA defined in
+bootloader.h. The patch is made against a PROG_MEM.BIN copied off the device, and only
+applies to a device whose flash still matches it. Copy the output file onto the USB_uC
+drive the same way as a hex file. Only erase rows the patch changes are rewritten.
+
+Usage:
+    python hex_delta.py PROG_MEM.BIN firmware.hex firmware.dp
+    python hex_delta.py PROG_MEM.BIN firmware.hex firmware.dp --pic16              (PIC16F145X)
+    python hex_delta.py PROG_MEM.BIN firmware.hex firmware.dp --prog-end 0x1FC00   (PIC18F47J53)
+
+Format:
+    "UCDP", CRC-32 of PROG_MEM.BIN (little endian), then records of 24-bit little endian
+    address, length (1-255) and data. A record with a length of 0 ends the patch.
+
+The result is the same as programming the hex file normally. Hex data outside of
+PROG_MEM.BIN (EEPROM, ID and config words) isn't part of the patch. A PROG_MEM.BIN from a
+bootloader built with USE_TRIM_PROG_MEM stops after the last programmed byte, flash past
+it is taken to be blank.
+"""
+
+import argparse
+import sys
+import zlib
+from hex_pack import read_hex
+
+
+# Constants
+MAGIC = b'UCDP'
+MAX_RECORD = 255
+MERGE_GAP = 4  # A new record costs 4 bytes, so close gaps are sent as data.
+
+
+def blank(size, pic16):
+    return bytearray(b'\xFF\x3F' * (size // 2) if pic16 else b'\xFF' * size)
+
+
+def target_image(old, image, prog_start, prog_end, pic16):
+    """ PROG_MEM.BIN as it would read after a normal erase and program. """
+    if prog_end:
+        size = prog_end - prog_start
+    else:
+        flash_end = 0x10000 if pic16 else 0x200000  # Config words and EEPROM are above these.
+        size = max([len(old)] + [address - prog_start + 1 for address in image if prog_start <= address < flash_end])
+        size += size & 1
+    new = blank(size, pic16) + old[size:]
+    for address, data in image.items():
+        index = address - prog_start
+        if 0 <= index < size:
+            new[index] = data & 0x3F if pic16 and (address & 1) else data
+    return new
+
+
+def make_patch(old, new, prog_start, pic16):
+    out = bytearray(MAGIC)
+    out.extend(zlib.crc32(old).to_bytes(4, 'little'))
+    old = old + blank(len(new) - len(old), pic16)  # Past the end of a trimmed PROG_MEM.BIN.
+    diffs = [i for i in range(len(old)) if old[i] != new[i]]
+    i = 0
+    while i < len(diffs):
+        start = end = diffs[i]
+        i += 1
+        while i < len(diffs) and diffs[i] - end <= MERGE_GAP and diffs[i] - start < MAX_RECORD:
+            end = diffs[i]
+            i += 1
+        out.extend((prog_start + start).to_bytes(3, 'little'))
+        out.append(end - start + 1)
+        out.extend(new[start:end + 1])
+    out.extend(b'\x00' * 4)
+    return out
+
+
+def apply_patch(old, patch, prog_start, size, pic16):
+    """ Mirrors delta_parse() in bootloader.c. """
+    if patch[:4] != MAGIC or int.from_bytes(patch[4:8], 'little') != zlib.crc32(old):
+        raise ValueError('Patch doesn\'t match PROG_MEM.BIN.')
+    new = bytearray(old) + blank(size - len(old), pic16)
+    pos = 8
+    while True:
+        address = int.from_bytes(patch[pos:pos + 3], 'little') - prog_start
+        length = patch[pos + 3]
+        pos += 4
+        if length == 0:
+            return new
+        new[address:address + length] = patch[pos:pos + length]
+        pos += length
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Make a USB_uC delta patch from PROG_MEM.BIN and a new hex file.')
+    parser.add_argument('bin_file', help='PROG_MEM.BIN copied off the device.')
+    parser.add_argument('hex_file')
+    parser.add_argument('out_file')
+    parser.add_argument('--prog-start', type=lambda x: int(x, 0), default=0x2000,
+                        help='Start of the user program region (default 0x2000).')
+    parser.add_argument('--prog-end', type=lambda x: int(x, 0), default=None,
+                        help='CONFIG_PAGE_START on J parts, the config page is never rewritten.')
+    parser.add_argument('--pic16', action='store_true', help='PIC16F145X, flash is 14bit words.')
+    args = parser.parse_args()
+
+    with open(args.bin_file, 'rb') as f:
+        old = bytearray(f.read())
+    new = target_image(old, read_hex(args.hex_file), args.prog_start, args.prog_end, args.pic16)
+    patch = make_patch(old, new, args.prog_start, args.pic16)
+    if apply_patch(old, patch, args.prog_start, len(new), args.pic16) != new:
+        sys.exit('Verify failed, nothing written.')
+    with open(args.out_file, 'wb') as f:
+        f.write(patch)
+    old += blank(len(new) - len(old), args.pic16)
+    print('%d bytes changed, %d byte patch' % (sum(a != b for a, b in zip(old, new)), len(patch)))
+
+
+if __name__ == '__main__':
+    main()
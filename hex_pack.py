@@ -0,0 +1,190 @@
+"""
+This python script packs an Intel HEX file into a UCLZ compressed image for bootloaders
+built with USE_UCLZ defined in bootloader.h. Copy the output file onto the USB_uC drive
+the same way as a hex file.
+
+Usage:
+    python hex_pack.py firmware.hex firmware.lz
+
+Format:
+    "UCLZ" followed by tags.
+    0x00-0x7F: Literal run, (tag + 1) bytes follow.
+    0x80-0xFD: Match of (tag - 0x80 + 4) bytes, 16-bit little endian distance follows.
+    0xFE:      New address, 24-bit little endian address follows.
+    0xFF:      End of image.
+
+Matches only reach back within the current address segment and only inside the user
+program region, as the bootloader reads them back from flash. The output is decoded
+again and compared to the hex file before it is written.
+"""
+
+import argparse
+import sys
+
+
+# Constants
+MAGIC = b'UCLZ'
+MIN_MATCH = 4
+MAX_MATCH = 0xFD - 0x80 + MIN_MATCH
+MAX_LITERAL = 0x80
+MAX_DIST = 0xFFFF
+TAG_MATCH = 0x80
+TAG_ADDR = 0xFE
+TAG_END = 0xFF
+CHAIN_LIMIT = 64
+
+
+def read_hex(path):
+    """ Returns a dictionary of address: byte from an Intel HEX file. """
+    image = {}
+    upper = 0
+    with open(path, 'r') as f:
+        for line_num, line in enumerate(f, 1):
+            line = line.strip()
+            if not line:
+                continue
+            if line[0] != ':':
+                sys.exit('Line %d: Missing start code.' % line_num)
+            rec = bytes.fromhex(line[1:])
+            if len(rec) < 5 or len(rec) != rec[0] + 5 or sum(rec) & 0xFF:
+                sys.exit('Line %d: Bad record.' % line_num)
+            rec_len, offset, rec_type, data = rec[0], (rec[1] << 8) | rec[2], rec[3], rec[4:-1]
+            if rec_type == 0x00:
+                for i in range(rec_len):
+                    image[upper + offset + i] = data[i]
+            elif rec_type == 0x01:
+                break
+            elif rec_type == 0x02:
+                upper = ((data[0] << 8) | data[1]) << 4
+            elif rec_type == 0x04:
+                upper = ((data[0] << 8) | data[1]) << 16
+    return image
+
+
+def segments(image):
+    """ Splits the image into runs of contiguous addresses. """
+    segs = []
+    for address in sorted(image):
+        if segs and segs[-1][0] + len(segs[-1][1]) == address:
+            segs[-1][1].append(image[address])
+        else:
+            segs.append((address, bytearray([image[address]])))
+    return segs
+
+
+def compress_segment(start, data, prog_start, prog_end):
+    """ Greedy LZ with hash chains, matches limited to the user program region. """
+    out = bytearray()
+    literals = bytearray()
+    chains = {}
+    # Sources must sit at or above both the segment start and the program region start.
+    floor = max(start, prog_start)
+
+    def flush_literals():
+        for i in range(0, len(literals), MAX_LITERAL):
+            run = literals[i:i + MAX_LITERAL]
+            out.append(len(run) - 1)
+            out.extend(run)
+        literals.clear()
+
+    pos = 0
+    while pos < len(data):
+        best_len = 0
+        best_dist = 0
+        address = start + pos
+        if prog_start <= address and address + MIN_MATCH <= prog_end and pos + MIN_MATCH <= len(data):
+            key = bytes(data[pos:pos + MIN_MATCH])
+            for cand in reversed(chains.get(key, [])[-CHAIN_LIMIT:]):
+                dist = pos - cand
+                if dist > MAX_DIST:
+                    break
+                if start + cand < floor:
+                    continue
+                length = 0
+                limit = min(MAX_MATCH, len(data) - pos, prog_end - address)
+                while length < limit and data[cand + length] == data[pos + length]:
+                    length += 1
+                if length > best_len:
+                    best_len, best_dist = length, dist
+                    if length == limit:
+                        break
+        if best_len >= MIN_MATCH:
+            flush_literals()
+            out.append(TAG_MATCH + best_len - MIN_MATCH)
+            out.extend(best_dist.to_bytes(2, 'little'))
+            step = best_len
+        else:
+            literals.append(data[pos])
+            step = 1
+        for i in range(pos, pos + step):
+            if i + MIN_MATCH <= len(data):
+                chains.setdefault(bytes(data[i:i + MIN_MATCH]), []).append(i)
+        pos += step
+    flush_literals()
+    return out
+
+
+def pack(image, prog_start, prog_end):
+    out = bytearray(MAGIC)
+    for start, data in segments(image):
+        out.append(TAG_ADDR)
+        out.extend(start.to_bytes(3, 'little'))
+        out.extend(compress_segment(start, data, prog_start, prog_end))
+    out.append(TAG_END)
+    return out
+
+
+def unpack(stream):
+    """ Mirrors lz_parse() in bootloader.c. """
+    if stream[:4] != MAGIC:
+        raise ValueError('Missing UCLZ magic.')
+    image = {}
+    pos = 4
+    address = seg_start = 0
+    while True:
+        tag = stream[pos]
+        pos += 1
+        if tag < TAG_MATCH:
+            for b in stream[pos:pos + tag + 1]:
+                image[address] = b
+                address += 1
+            pos += tag + 1
+        elif tag < TAG_ADDR:
+            dist = int.from_bytes(stream[pos:pos + 2], 'little')
+            pos += 2
+            src = address - dist
+            if dist == 0 or src < seg_start:
+                raise ValueError('Match out of range at 0x%06X.' % address)
+            for _ in range(tag - TAG_MATCH + MIN_MATCH):
+                image[address] = image[src]
+                address += 1
+                src += 1
+        elif tag == TAG_ADDR:
+            address = seg_start = int.from_bytes(stream[pos:pos + 3], 'little')
+            pos += 3
+        else:
+            return image
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Pack an Intel HEX file into a USB_uC UCLZ image.')
+    parser.add_argument('hex_file')
+    parser.add_argument('out_file')
+    parser.add_argument('--prog-start', type=lambda x: int(x, 0), default=0x2000,
+                        help='Start of the user program region (default 0x2000).')
+    parser.add_argument('--prog-end', type=lambda x: int(x, 0), default=0x1FC00,
+                        help='End of flash the bootloader can read back, CONFIG_PAGE_START on J parts '
+                             '(default 0x1FC00).')
+    args = parser.parse_args()
+
+    image = read_hex(args.hex_file)
+    stream = pack(image, args.prog_start, args.prog_end)
+    if unpack(stream) != image:
+        sys.exit('Verify failed, nothing written.')
+    with open(args.out_file, 'wb') as f:
+        f.write(stream)
+    print('%d bytes -> %d bytes (%.1f%%)' % (len(image), len(stream), 100.0 * len(stream) / max(len(image), 1)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,272 @@
+"""
+This python script measures the host build of the bootloader (see host_test.py) and prints
+the results as markdown tables. 'Host Tests/README.md' holds the last results.
+
+Instruction counts are host (x86-64) instructions spent in bootloader code, counted by single
+stepping the sim with 'Host Tests/icount.c'. The bootloader is built with gcc -Os, as the
+MPLAB X project builds it with XC8 -Os. Time spent in the flash and EEPROM stand-ins isn't
+counted. The counts compare revisions and options on the same input, they aren't PIC cycles.
+
+Prerequisites:
+- gcc, python 3.9 or later and Linux (ptrace).
+- Run from a git clone, earlier revisions are built from git history.
+
+Usage:
+    python host_bench.py             Runs every benchmark, this takes a few minutes.
+    python host_bench.py name ...    Runs the named benchmarks.
+"""
+
+import os
+import random
+import re
+import sys
+from modules.hostsim import (ROOT_DIR, PARTS, build, run, request_rev, make_hex, expected, mismatch, real_hexes,
+                             read_volume)
+
+
+# Constants
+# Timing model, in microseconds. These are assumed round figures, change them for a part's
+# datasheet. 19 bulk packets fit in a full speed frame, which is the most the host can send.
+T_PACKET = 1000 / 19
+T_WRITE = 2000 # Self-timed block write.
+T_ERASE = 2000 # Row erase.
+T_WORD = 2000  # Flash_WriteWord.
+# Erase/write cycles per flash row, assumed from the datasheet minimums.
+ENDURANCE = {'47j53': 10000, '1459': 100000} # Program flash, High-Endurance Flash.
+EMU_EEPROM = {'47j53': (256, 2), '1459': (32, 4)} # USE_EMU_EEPROM bytes and rows in the log.
+EEPROM_START = 0xF00000
+TEST_APPS = {'4550': 'Test_4550_FAMILY.X', '14k50': 'Test_14K50.X'} # Test apps with __EEPROM_DATA.
+
+
+# Benchmarks
+BENCHES = []
+
+def bench(func):
+    BENCHES.append(func)
+    return func
+
+def table(header: list[str], rows: list[list]):
+    print('| ' + ' | '.join(header) + ' |')
+    print('|' + '|'.join('---' for _ in header) + '|')
+    for row in rows:
+        print('| ' + ' | '.join(str(c) for c in row) + ' |')
+    print()
+
+
+@bench
+def hex_parser():
+    """
+    user-001: Host instructions per HEX character in boot_process_write(), before user-001,
+    at user-001 and now, on a test application and a bootloader image moved up to 0x2000.
+    """
+    revs = [('Before', request_rev('user-001') + '^'), ('At the commit', request_rev('user-001')), ('Current', None)]
+    rows = []
+    for part in PARTS:
+        hexes = real_hexes(part)
+        for name, image, text in [hexes[0], next(h for h in hexes if not h[0].startswith('Test_'))]:
+            row = [PARTS[part].name, name, len(text)]
+            for _, rev in revs:
+                result = run(part, build(part, rev=rev, opt='-Os'), text, count='w')
+                if mismatch(result.flash, expected(part, image), end=PARTS[part].prog_end):
+                    raise AssertionError(f'{part} {name} {rev}: wrong flash contents.')
+                row.append('%.1f' % (result['instructions'] / len(text)))
+            rows.append(row)
+    table(['Part', 'File', 'Characters'] + [name for name, _ in revs], rows)
+
+def test_app_eeprom(part: str) -> list[int]:
+    """ The bytes in the __EEPROM_DATA lines sketched (commented out) in the part's test app. """
+    with open(os.path.join(ROOT_DIR, 'USB_uC_Test', TEST_APPS[part], 'main.c'), 'r') as f:
+        lines = re.findall(r'__EEPROM_DATA\(([^)]*)\)', f.read())
+    return [int(b, 0) for line in lines for b in line.split(',')]
+
+@bench
+def double_buffer():
+    """
+    user-011: HEX file throughput in KB/s from the timing model in sim.c (-t), without and with
+    USE_DOUBLE_BUFFER, on a blank part and over old firmware (the user region is erased first).
+    A packet takes 52.6us, a block write or row erase stalls the core for 2ms, and the
+    bootloader's own processing time is taken as zero.
+    """
+    rows = []
+    for part in PARTS:
+        name, image, text = next(h for h in real_hexes(part) if not h[0].startswith('Test_'))
+        for preload, state in ((0, 'Blank'), (1, 'Old firmware')):
+            row = [PARTS[part].name, name, len(text), state]
+            kbps = []
+            for options in ([], ['USE_DOUBLE_BUFFER']):
+                result = run(part, build(part, options), text, preload=preload,
+                             timing=(T_PACKET, T_WRITE, T_ERASE, T_WORD))
+                if mismatch(result.flash, expected(part, image), end=PARTS[part].prog_end):
+                    raise AssertionError(f'{part} {name} {options}: wrong flash contents.')
+                kbps.append(len(text) / result['time_us'] * 1e6 / 1024)
+                row += ['%.0f' % (result['time_us'] / 1000), '%.1f' % kbps[-1]]
+            row.append('%+.1f%%' % (100 * (kbps[1] / kbps[0] - 1)))
+            rows.append(row)
+    table(['Part', 'File', 'Characters', 'Flash', 'Time (ms)', 'KB/s', 'Double buffered (ms)', 'KB/s', 'Change'], rows)
+
+@bench
+def flash_read():
+    """
+    user-012: Host instructions to read all of PROG_MEM.BIN through boot_process_read(), with
+    the bootloader and flash.c from before user-012 and now.
+    """
+    rows = []
+    for part in PARTS:
+        counts = []
+        for rev in (request_rev('user-012') + '^', None):
+            sim = build(part, rev=rev, opt='-Os')
+            flash = run(part, sim, preload=1).flash
+            info, files = read_volume(run(part, sim, flash=flash, dump=1500).disk)
+            _, _, size, data, lba = files['PROG_MEM.BIN']
+            if data != bytes(flash[0x2000:0x2000 + size]):
+                raise AssertionError(f'{part}: PROG_MEM.BIN doesn\'t match flash.')
+            end = lba + (size + 511) // 512
+            before = run(part, sim, flash=flash, dump=lba, count='r')['instructions']
+            counts.append(run(part, sim, flash=flash, dump=end, count='r')['instructions'] - before)
+        rows.append([PARTS[part].name, size, counts[0], '%.1f' % (counts[0] / size), counts[1],
+                     '%.1f' % (counts[1] / size), '%+.0f%%' % (100 * (counts[1] / counts[0] - 1))])
+    table(['Part', 'PROG_MEM.BIN bytes', 'Before', 'Per byte', 'Current', 'Per byte', 'Change'], rows)
+
+@bench
+def emu_wear():
+    """
+    user-018: Flash writes and pages erased by the USE_EMU_EEPROM log for 5000 byte writes that
+    each change the byte, for three workloads. Each record is a word write, a compaction copies
+    the records a block write at a time. Flash writes per write counts both, and every row of the log
+    is erased as often as the others, so it wears out after ENDURANCE erases of each row.
+    """
+    rows = []
+    for part, (size, log_rows) in EMU_EEPROM.items():
+        sim = build(part, ['USE_EMU_EEPROM'])
+        rng = random.Random(1)
+        workloads = {
+            'Random bytes': [rng.randrange(size) for _ in range(5000)],
+            'One hot byte': [0] * 5000,
+            'Whole EEPROM rewritten': [i % size for i in range(5000)],
+        }
+        for name, addrs in workloads.items():
+            data = [0xFF] * size
+            workload = bytearray()
+            for addr in addrs:
+                data[addr] = (data[addr] + 1 + rng.randrange(255)) & 0xFF # Never the same value.
+                workload += bytes([addr, data[addr]])
+            result = run(part, sim, flash=run(part, sim, preload=1).flash, workload=bytes(workload))
+            if list(result.eeprom[:size]) != data:
+                raise AssertionError(f'{part} {name}: wrong EEPROM contents.')
+            per_erase = len(addrs) / result['erases']
+            rows.append([PARTS[part].name, name, len(addrs), result['words'], result['writes'], result['erases'],
+                         '%.2f' % ((result['words'] + result['writes']) / len(addrs)), '%.0f' % per_erase,
+                         '%.1fM' % (ENDURANCE[part] * log_rows * per_erase / 1e6)])
+    table(['Part', 'Workload', 'Writes', 'Word writes', 'Block writes', 'Erases', 'Flash writes per write', 'Writes per row erase',
+           'Writes to wear out'], rows)
+
+@bench
+def eeprom_records():
+    """
+    user-019: EEPROM write cycles for HEX files that hold a test application and EEPROM
+    records, before and after user-019. The EEPROM data is the __EEPROM_DATA sketched in the
+    USB_uC_Test apps, or random bytes at every third address. "Right" is whether EEPROM held
+    every byte of the records afterwards.
+    """
+    rows = []
+    for part in TEST_APPS:
+        data = test_app_eeprom(part)
+        rng = random.Random(7)
+        app = next(image for name, image, _ in real_hexes(part) if name.startswith('Test_'))
+        cases = [('__EEPROM_DATA, first 4 lines', {i: data[i] for i in range(32)}, None),
+                 ('__EEPROM_DATA, all 32 lines', dict(enumerate(data)), None),
+                 ('__EEPROM_DATA, records shuffled', dict(enumerate(data)), 3),
+                 ('Every third byte, records shuffled', {i: rng.randrange(256) for i in range(0, 256, 3)}, 3)]
+        for name, eeprom, shuffle in cases:
+            image = dict(app)
+            image.update({EEPROM_START + a: d for a, d in eeprom.items()})
+            row = [PARTS[part].name, name, len(eeprom)]
+            for rev in (request_rev('user-019') + '^', None):
+                result = run(part, build(part, rev=rev), make_hex(image, shuffle=shuffle))
+                if mismatch(result.flash, expected(part, app), end=PARTS[part].prog_end):
+                    raise AssertionError(f'{part} {name} {rev}: wrong flash contents.')
+                right = all(result.eeprom[a] == d for a, d in eeprom.items())
+                row += [result['ee_writes'], 'Yes' if right else 'No']
+            rows.append(row)
+    table(['Part', 'EEPROM data', 'Bytes', 'Before', 'Right', 'Current', 'Right'], rows)
+
+@bench
+def eeprom_read():
+    """
+    user-020: Host instructions for boot_process_read() to serve EEPROM.BIN three times, as a
+    host that reads the drive again does, before and after user-020 and with USE_EEPROM_MIRROR.
+    """
+    rows = []
+    for part in ('4550', '14k50'):
+        configs = [('Before', [], request_rev('user-020') + '^'), ('Current', [], None)]
+        if part == '4550': # The mirror doesn't fit in the PIC18F14K50's RAM.
+            configs.append(('USE_EEPROM_MIRROR', ['USE_EEPROM_MIRROR'], None))
+        eeprom = bytes(random.Random(3).randrange(256) for _ in range(256))
+        for name, options, rev in configs:
+            sim = build(part, options, rev=rev, opt='-Os')
+            files = read_volume(run(part, sim, eeprom=eeprom, dump=1500).disk)[1]
+            lba = files['EEPROM.BIN'][4]
+            result = run(part, sim, eeprom=eeprom, dump=lba + 1, passes=3)
+            if read_volume(result.disk)[1]['EEPROM.BIN'][3][:256] != eeprom:
+                raise AssertionError(f'{part} {name}: EEPROM.BIN is not EEPROM.')
+            count = (run(part, sim, eeprom=eeprom, dump=lba + 1, passes=3, count='r')['instructions']
+                     - run(part, sim, eeprom=eeprom, dump=lba, passes=3, count='r')['instructions'])
+            rows.append([PARTS[part].name, name, count])
+    table(['Part', 'Build', 'Instructions'], rows)
+
+@bench
+def cluster_size():
+    """
+    user-024: The volume for each SECT_PER_CLUS, with PROG_MEM.HEX. Clusters is the length of
+    the file's FAT chain, which the host walks to find its sectors. Instructions are host
+    instructions for boot_process_read() to serve all of PROG_MEM.BIN.
+    """
+    rows = []
+    for part in ('4550', '1459'):
+        flash = run(part, build(part, ['USE_PROG_MEM_HEX']), preload=1).flash
+        for spc in (1, 4, 8, 64):
+            sim = build(part, ['USE_PROG_MEM_HEX'], opt='-Os',
+                        subst={'usb_msd_config.h': ('#define SECT_PER_CLUS 1 ', f'#define SECT_PER_CLUS {spc} ')})
+            info, files = read_volume(run(part, sim, flash=flash, dump=4000).disk)
+            _, _, size, _, lba = files['PROG_MEM.BIN']
+            end = lba + (size + 511) // 512
+            count = (run(part, sim, flash=flash, dump=end, count='r')['instructions']
+                     - run(part, sim, flash=flash, dump=lba, count='r')['instructions'])
+            chains = [-(-files[name][2] // (spc * 512)) for name in ('PROG_MEM.BIN', 'PROG_MEM.HEX')]
+            rows.append([PARTS[part].name, spc, info['total'], '%.1f' % (info['total'] / 2048), info['fat_size'],
+                         chains[0], chains[1], '%.1f' % (count / size)])
+    table(['Part', 'SECT_PER_CLUS', 'Blocks', 'MB', 'FAT sectors', 'PROG_MEM.BIN clusters',
+           'PROG_MEM.HEX clusters', 'Instructions per byte'], rows)
+
+@bench
+def fast_mount():
+    """
+    user-025: The default FAT16 volume and the USE_FAST_MOUNT FAT12 volume, with PROG_MEM.HEX and
+    user flash full of an application. Metadata sectors are the boot sector, FAT and root
+    directory a host reads to mount the drive, and instructions are host instructions for
+    boot_process_read() to serve them.
+    """
+    rows = []
+    for part in PARTS:
+        for name, subst in (('FAT16', None),
+                            ('FAT12, USE_FAST_MOUNT', {'usb_msd_config.h': ('//#define USE_FAST_MOUNT', '#define USE_FAST_MOUNT')})):
+            sim = build(part, ['USE_PROG_MEM_HEX'], subst=subst, opt='-Os')
+            info, _ = read_volume(run(part, sim, preload=6, dump=1500).disk)
+            count = run(part, sim, preload=6, dump=info['data_lba'], count='r')['instructions']
+            rows.append([PARTS[part].name, name, info['total'], '%.0f' % (info['total'] / 2), info['fat_size'],
+                         info['data_lba'], count])
+    table(['Part', 'Volume', 'Blocks', 'KB', 'FAT sectors', 'Metadata sectors', 'Instructions'], rows)
+
+
+def main():
+    names = sys.argv[1:]
+    for func in BENCHES:
+        if names and func.__name__ not in names:
+            continue
+        print(f'## {func.__name__}\n')
+        print(' '.join(func.__doc__.split()) + '\n')
+        func()
+
+
+if __name__ == '__main__':
+    main()
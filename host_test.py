@@ -0,0 +1,619 @@
+"""
+This python script builds the bootloader for the host with gcc and checks what it writes to
+flash, EEPROM and the drive. The host build is described in 'Host Tests/sim.c'. Each test
+builds the options it needs for the PIC18F4550, PIC18F14K50, PIC18F47J53 and PIC16F1459.
+
+Prerequisites:
+- gcc and python 3.9 or later.
+- Run from a git clone.
+
+Usage:
+    python host_test.py             Runs every test.
+    python host_test.py name ...    Runs the named tests.
+"""
+
+import os
+import random
+import re
+import sys
+import zlib
+import hex_delta
+from modules.hostsim import (PARTS, PROG_START, SRC_DIR, BUILD_DIR, SimError, build, run, make_hex, random_image,
+                             expected, whole_words, mismatch, real_hexes, read_volume, hex_pack, make_uf2, hex_record)
+
+
+# Constants
+DUMP_SECTORS = 1500 # Enough to hold every file on every part.
+EEPROM_START = 0xF00000
+EMU_EEPROM = {'47j53': (256, 0x1F400), '1459': (32, 0x3F00)} # USE_EMU_EEPROM bytes and log start.
+CACHE_SLOTS = {'4550': 4, '14k50': 4, '47j53': 8, '1459': 2} # BLOCK_CACHE_SLOTS in bootloader.h.
+UF2_FAMILY = {'4550': 0x18F14B00, '14k50': 0x18F14B00, '47j53': 0x18F14B00, '1459': 0x16E14B00} # As bootloader.h.
+RP2040_FAMILY = 0xE48BFF56
+
+
+# Tests
+TESTS = []
+
+def test(func):
+    TESTS.append(func)
+    return func
+
+def check(condition: bool, message: str):
+    if not condition:
+        raise AssertionError(message)
+
+def check_flash(part: str, result, exp: bytes, what: str, end: int = None, flash: bytes = None):
+    where = mismatch(result.flash if flash is None else flash, exp, PROG_START, end or PARTS[part].prog_end)
+    check(not where, f'{part} {what}: {where}')
+
+def source_define(name: str) -> int:
+    with open(os.path.join(SRC_DIR, 'bootloader.h'), 'r') as f:
+        return int(re.search(rf'#define {name} +(\w+)', f.read()).group(1), 0)
+
+def volume(part: str, sim: str, flash: bytes) -> dict:
+    """ Returns the files on the drive for this flash, see read_volume(). """
+    return read_volume(run(part, sim, flash=flash, dump=DUMP_SECTORS).disk)[1]
+
+
+@test
+def hex_records():
+    # Records from 1 to 255 bytes end part way through packets, and lines are split across them.
+    for part in PARTS:
+        sim = build(part)
+        for rec_len in (255, 64, 32, 16, 8, 3, 1):
+            image = random_image(part, size=None if rec_len > 3 else 0x2000, seed=rec_len)
+            check_flash(part, run(part, sim, make_hex(image, rec_len)), expected(part, image), f'{rec_len} byte records')
+
+@test
+def hex_real_files():
+    for part in PARTS:
+        sim = build(part)
+        for name, image, text in real_hexes(part):
+            check_flash(part, run(part, sim, text), expected(part, image), name)
+
+@test
+def hex_checksum():
+    # A bad checksum fails the image, the user region is left erased.
+    for part in PARTS:
+        sim = build(part)
+        lines = make_hex(random_image(part, size=3000, seed=5)).split('\r\n')
+        lines[5] = lines[5][:-2] + '%02X' % (int(lines[5][-2:], 16) ^ 1)
+        result = run(part, sim, '\r\n'.join(lines), preload=7)
+        check_flash(part, result, expected(part, {}), 'bad checksum')
+        # A 255 byte record that crosses blocks, some of them written before its checksum is read.
+        image = random_image(part, size=3000, seed=6, gaps=False)
+        lines = make_hex(image, rec_len=255).split('\r\n')
+        lines[4] = lines[4][:-2] + '%02X' % (int(lines[4][-2:], 16) ^ 1)
+        result = run(part, sim, '\r\n'.join(lines), preload=7)
+        check_flash(part, result, expected(part, {}), 'bad checksum in a long record')
+
+@test
+def uf2():
+    # A UF2 image is programmed, with or without a family ID. Blocks for another family are
+    # skipped, even at an address that would wrap into user flash if cut to 24 bits. A block
+    # outside the user region fails the image.
+    for part in PARTS:
+        sim = build(part, ['USE_UF2'])
+        image = random_image(part, size=0x1800, seed=14)
+        for family in (None, UF2_FAMILY[part]):
+            result = run(part, sim, make_uf2(image, family), preload=2)
+            check_flash(part, result, expected(part, image), f'UF2 family {family}')
+        ours = make_uf2(image, UF2_FAMILY[part])
+        foreign = make_uf2({0x10002000 + i: 0x55 for i in range(0x800)}, RP2040_FAMILY)
+        mixed = b''.join(ours[i:i + 512] + foreign[i:i + 512] for i in range(0, len(ours), 512))
+        check_flash(part, run(part, sim, mixed, preload=2), expected(part, image), 'UF2 with another family')
+        for addr in (0x10002000, 0x20000):
+            bad = make_uf2(image) + make_uf2({addr + i: 0x55 for i in range(256)})
+            bad = bad[:512] + bad[-512:] + bad[512:-512]
+            check_flash(part, run(part, sim, bad, preload=2), expected(part, {}), 'UF2 block at 0x%X' % addr)
+
+@test
+def bin_write():
+    # Writing PROG_MEM.BIN in place programs flash. 512 bytes is half a row on the PIC18F47J53,
+    # that row is written once the host has been quiet for BIN_IDLE_TASKS main loop passes.
+    idle = source_define('BIN_IDLE_TASKS')
+    for part in PARTS:
+        sim = build(part, ['USE_BIN_WRITE'])
+        base = run(part, sim, make_hex(random_image(part, size=5000, seed=3))).flash
+        lba = volume(part, sim, base)['PROG_MEM.BIN'][4]
+        data = bytes(random.Random(2).randrange(256) for _ in range(512))
+        exp = expected(part, {PROG_START + i: d & PARTS[part].blank(i) for i, d in enumerate(data)}, base)
+        result = run(part, sim, data, lba=lba, flash=base, idle=idle)
+        check_flash(part, result, exp, 'PROG_MEM.BIN write once idle', flash=result.idle)
+        check_flash(part, result, exp, 'PROG_MEM.BIN write')
+
+@test
+def uclz_round_trip():
+    # Real hex files packed by hex_pack.py and decoded by lz_parse(), alone and with the options
+    # that change where back-references are read from. The second copy of each bootloader image
+    # gives matches that reach back across rows.
+    option_sets = [['USE_UCLZ'], ['USE_UCLZ', 'USE_SKIP_SAME'], ['USE_UCLZ', 'USE_DOUBLE_BUFFER'],
+                   ['USE_UCLZ', 'USE_ERASE_ON_DEMAND'], ['USE_UCLZ', 'USE_BLOCK_CACHE']]
+    for part in PARTS:
+        end = PARTS[part].prog_end
+        images = []
+        for name, image, _ in real_hexes(part):
+            images.append((name, image))
+            if not name.startswith('Test_'):
+                copy = dict(image)
+                copy.update({a + 0x1100: d for a, d in image.items() if a + 0x1100 < end})
+                images.append((name + ' twice', copy))
+        for name, image in images:
+            stream = hex_pack.pack(image, PROG_START, end)
+            check(hex_pack.unpack(stream) == image, f'{part} {name}: hex_pack.py doesn\'t round trip.')
+            for options in option_sets:
+                result = run(part, build(part, options), bytes(stream))
+                check_flash(part, result, expected(part, image), f'{name} {" ".join(options)}')
+
+@test
+def delta_patch():
+    # A patch made against other firmware is ignored and counted in STATUS.TXT, and the right
+    # patch is still taken in the same session. The new firmware is a real bootloader image.
+    for part in PARTS:
+        p = PARTS[part]
+        sim = build(part, ['USE_DELTA'])
+        prog_end = p.prog_end if part == '47j53' else None # CONFIG_PAGE_START, as hex_delta.py is told.
+        new = next(image for name, image, _ in real_hexes(part) if not name.startswith('Test_'))
+        flashes, patches, targets = [], [], []
+        for seed in (5, 6):
+            flash = run(part, sim, preload=seed).flash
+            old = bytearray(volume(part, sim, flash)['PROG_MEM.BIN'][3])
+            target = hex_delta.target_image(old, new, PROG_START, prog_end, p.pic16)
+            flashes.append(flash)
+            patches.append(bytes(hex_delta.make_patch(old, target, PROG_START, p.pic16)))
+            targets.append(target)
+        result = run(part, sim, patches[0], flash=flashes[1], dump=DUMP_SECTORS)
+        files = read_volume(result.disk)[1]
+        check(files['PROG_MEM.BIN'][3] == bytes(volume(part, sim, flashes[1])['PROG_MEM.BIN'][3]),
+              f'{part}: a patch for other firmware changed flash.')
+        check(b'Patches rejected: 00001' in files['STATUS.TXT'][3], f'{part}: the rejected patch is not counted.')
+        result = run(part, sim, patches[0], flash=flashes[1], second=(patches[1], 0x300), dump=DUMP_SECTORS)
+        check(read_volume(result.disk)[1]['PROG_MEM.BIN'][3] == bytes(targets[1]),
+              f'{part}: the right patch after a rejected one was not applied.')
+
+def write_size(part: str) -> int:
+    """ Bytes per block write, from the part's _FLASH_WRITE_SIZE. """
+    words = next(int(d.split('=')[1]) for d in PARTS[part].defines if d.startswith('-D_FLASH_WRITE_SIZE='))
+    return words * (2 if PARTS[part].pic16 else 1)
+
+def erase_size(part: str) -> int:
+    """ Bytes per row erase, from the part's _FLASH_ERASE_SIZE. """
+    words = next(int(d.split('=')[1]) for d in PARTS[part].defines if d.startswith('-D_FLASH_ERASE_SIZE='))
+    return words * (2 if PARTS[part].pic16 else 1)
+
+@test
+def flash_write_range():
+    # Flash_WriteRange() called straight from sim.c with unaligned ranges, some sharing a block.
+    # Each block a range touches is written once, with nothing erased, and the timing model
+    # stalls for each write.
+    for part in PARTS:
+        p = PARTS[part]
+        block = write_size(part)
+        rng = random.Random(15)
+        image, ranges, blocks = {}, bytearray(), 0
+        addr = PROG_START + 6
+        while addr < PROG_START + 0x1800:
+            length = rng.randrange(1, 300) & ~1
+            data = [rng.randrange(256) & p.blank(addr + i) for i in range(length)]
+            image.update({addr + i: d for i, d in enumerate(data)})
+            ranges += addr.to_bytes(4, 'little') + length.to_bytes(2, 'little') + bytes(data)
+            blocks += (addr + length - 1) // block - addr // block + 1
+            addr += length + rng.choice((0, 2, 10, block))
+        result = run(part, build(part), ranges=bytes(ranges), timing=(0, 2000, 2000, 2000))
+        check_flash(part, result, expected(part, image), 'Flash_WriteRange')
+        writes = result['writes'] + result['words'] # A range that ends on a row's first PIC16 latch writes a word.
+        check(writes == blocks and result['erases'] == 0, f'{part}: {writes} writes for {blocks} blocks.')
+        check(result['time_us'] == 2000 * writes, f'{part}: {result["time_us"]}us for {writes} writes.')
+
+@test
+def erase_on_demand():
+    # USE_ERASE_ON_DEMAND erases the rows a HEX image writes to, once each, and keeps the rest of
+    # the old application. FULL_WIPE erases the rest too once the image is finished.
+    for part in PARTS:
+        p = PARTS[part]
+        row = erase_size(part)
+        base = expected(part, random_image(part, seed=19, gaps=False))
+        image = random_image(part, size=0x1800, seed=20)
+        rows = {a - (a - PROG_START) % row for a in image}
+        for options in (['USE_ERASE_ON_DEMAND'], ['USE_ERASE_ON_DEMAND', 'FULL_WIPE']):
+            result = run(part, build(part, options), make_hex(image, rec_len=32), flash=base)
+            what = f'{part} {options}'
+            if 'FULL_WIPE' in options:
+                exp, erases = expected(part, image), (p.prog_end - PROG_START) // row
+            else:
+                old = bytearray(base)
+                for a in rows:
+                    old[a:a + row] = bytes(p.blank(b) for b in range(a, a + row))
+                exp, erases = expected(part, image, old), len(rows)
+            check_flash(part, result, exp, what)
+            check(result['erases'] == erases, f'{what}: {result["erases"]} erases, expected {erases}.')
+
+@test
+def skip_blank():
+    # USE_SKIP_BLANK leaves out the writes of blocks that are all blank, padding in the image,
+    # and flash ends up the same.
+    for part in PARTS:
+        p = PARTS[part]
+        block = write_size(part)
+        rng = random.Random(21)
+        image, blocks = {}, 0
+        for addr in range(PROG_START, PROG_START + 0x1000, block):
+            blank = rng.random() < 0.4
+            blocks += not blank
+            for a in range(addr, addr + block):
+                image[a] = p.blank(a) if blank or rng.random() < 0.5 else rng.randint(0, 255) & p.blank(a)
+        for options in ([], ['USE_SKIP_BLANK']):
+            result = run(part, build(part, options), make_hex(image), preload=3)
+            what = f'{part} {options}'
+            writes = blocks if options else 0x1000 // block
+            check_flash(part, result, expected(part, image), what)
+            check(result['writes'] + result['words'] == writes, f'{what}: {result["writes"]} writes, expected {writes}.')
+
+@test
+def erase_check():
+    # USE_ERASE_CHECK erases through Flash_EraseUsed(), which reads each row first and only
+    # erases those that aren't blank, whether the whole region goes up front or row by row.
+    for part in PARTS:
+        p = PARTS[part]
+        row = erase_size(part)
+        rng = random.Random(22)
+        used = sorted(rng.sample(range(PROG_START, p.prog_end, row), 5))
+        base = expected(part, {a + i: rng.randint(0, 255) & p.blank(a + i) for a in used for i in range(0, row, 7)})
+        image = random_image(part, size=0x800, seed=23)
+        for options in ([], ['USE_ERASE_CHECK'], ['USE_ERASE_CHECK', 'USE_ERASE_ON_DEMAND', 'FULL_WIPE']):
+            result = run(part, build(part, options), make_hex(image), flash=base)
+            what = f'{part} {options}'
+            erases = len(used) if options else (p.prog_end - PROG_START) // row
+            check_flash(part, result, expected(part, image), what)
+            check(result['erases'] == erases, f'{what}: {result["erases"]} erases, expected {erases}.')
+
+@test
+def flash_read():
+    # PROG_MEM.BIN is read through Flash_ReadBytes() from flash.c, on the emulated table and
+    # PMCON registers, and matches flash.
+    for part in PARTS:
+        sim = build(part)
+        flash = run(part, sim, preload=2).flash
+        _, _, size, data, _ = volume(part, sim, flash)['PROG_MEM.BIN']
+        check(data == bytes(flash[PROG_START:PROG_START + size]), f'{part}: PROG_MEM.BIN is not flash.')
+
+def interleaved_hex(part: str, streams: int, seed: int) -> tuple[dict[int, int], str]:
+    """ 16 byte records from streams block aligned runs of flash, taking turns, as a linker
+        interleaving psects writes them. Returns the image and its HEX. """
+    rng = random.Random(seed)
+    span = 0x1000 // streams
+    runs = []
+    for n in range(streams):
+        start = PROG_START + n * span
+        end = start + span - rng.randrange(40)
+        runs.append([{a: rng.randrange(256) & PARTS[part].blank(a) for a in range(rec, min(rec + 16, end))}
+                     for rec in range(start, end, 16)])
+    image, lines = {}, [hex_record(0, 4, [0, 0])]
+    for recs in zip(*runs):
+        for rec in recs:
+            image.update(rec)
+            lines.append(hex_record(min(rec) & 0xFFFF, 0, list(rec.values())))
+    for recs in runs: # Runs that are longer than the shortest.
+        for rec in recs[min(len(r) for r in runs):]:
+            image.update(rec)
+            lines.append(hex_record(min(rec) & 0xFFFF, 0, list(rec.values())))
+    return whole_words(part, image), ''.join(lines) + ':00000001FF\r\n'
+
+@test
+def block_cache():
+    # With USE_BLOCK_CACHE, records from up to BLOCK_CACHE_SLOTS runs of flash taking turns
+    # program each block once.
+    for part in PARTS:
+        sim = build(part, ['USE_BLOCK_CACHE'])
+        for streams in sorted({2, CACHE_SLOTS[part]}):
+            image, text = interleaved_hex(part, streams, streams)
+            result = run(part, sim, text, preload=4)
+            check_flash(part, result, expected(part, image), f'{streams} interleaved runs')
+            blocks = len({a // write_size(part) for a in image})
+            check(result['writes'] == blocks, f'{part} {streams} runs: {result["writes"]} writes for {blocks} blocks.')
+
+def used_end(part: str, flash: bytes) -> int:
+    """ Address after the last byte of the user region that isn't blank, in whole words. """
+    p = PARTS[part]
+    end = next((a + 1 for a in range(p.prog_end - 1, PROG_START - 1, -1) if flash[a] != p.blank(a)), PROG_START)
+    return end + (end & 1) if p.pic16 else end
+
+@test
+def prog_mem_crc():
+    # PROG_MEM.CRC holds the CRC-32s of PROG_MEM.BIN, EEPROM and the config words, and the used
+    # length of flash, as worked out here from what sim.c holds after programming.
+    config = {'4550': (0, 14), '14k50': (0, 14), '1459': (0x0E, 4)} # CONFIG_WORDS_START in config.bin, and size.
+    for part in PARTS:
+        p = PARTS[part]
+        sim = build(part, ['USE_PROG_MEM_CRC'])
+        image = random_image(part, size=0x1234, seed=16)
+        if p.eeprom:
+            image.update({EEPROM_START + a: (a * 7) & 0xFF for a in range(0, 200, 3)})
+        result = run(part, sim, make_hex(image), preload=3)
+        files = read_volume(run(part, sim, flash=result.flash, eeprom=result.eeprom, dump=DUMP_SECTORS).disk)[1]
+        size = files['PROG_MEM.BIN'][2]
+        if part == '47j53': # J parts keep the config words in flash.
+            config_words = result.flash[0x1FFF8:0x20000]
+        else:
+            config_words = result.config[config[part][0]:sum(config[part])]
+        exp = {'Flash CRC-32': zlib.crc32(result.flash[PROG_START:PROG_START + size]),
+               'Flash length': used_end(part, result.flash) - PROG_START,
+               'Config CRC-32': zlib.crc32(config_words)}
+        if p.eeprom:
+            exp['EEPROM CRC-32'] = zlib.crc32(result.eeprom[:256])
+        got = dict(line.split(':') for line in files['PROG_MEM.CRC'][3].decode().split('\r\n') if line)
+        got = {name: int(value, 16) for name, value in got.items()}
+        check(got == exp, f'{part}: PROG_MEM.CRC {got}, expected {exp}.')
+
+@test
+def trim_prog_mem():
+    # With USE_TRIM_PROG_MEM the root entry sizes PROG_MEM.BIN to the 512 bytes holding the last
+    # programmed byte, and the file holds flash up to there.
+    for part in PARTS:
+        sim = build(part, ['USE_TRIM_PROG_MEM'])
+        for size in (0x10, 0x1234, 0x1E01):
+            flash = run(part, sim, make_hex(random_image(part, size=size, seed=size)), preload=3).flash
+            files = volume(part, sim, flash)
+            exp = (used_end(part, flash) - PROG_START + 511) // 512 * 512
+            what = f'{part} size {size:#x}'
+            check(files['PROG_MEM.BIN'][2] == exp, f'{what}: PROG_MEM.BIN is {files["PROG_MEM.BIN"][2]} bytes, not {exp}.')
+            check(files['PROG_MEM.BIN'][3] == flash[PROG_START:PROG_START + exp], f'{what}: PROG_MEM.BIN differs from flash.')
+
+@test
+def prog_mem_hex():
+    # PROG_MEM.HEX read back gives flash, EEPROM and the config words as they are, with flash
+    # ending where PROG_MEM.BIN does.
+    config = {'4550': (0x300000, 0, 14), '14k50': (0x300000, 0, 14), '1459': (0x1000E, 0x0E, 4)}
+    for part in PARTS:
+        p = PARTS[part]
+        image = random_image(part, size=0x1234, seed=17)
+        if p.eeprom:
+            image.update({EEPROM_START + a: (a * 5) & 0xFF for a in range(0, 256, 2)})
+        for options in (['USE_PROG_MEM_HEX'], ['USE_PROG_MEM_HEX', 'USE_TRIM_PROG_MEM']):
+            sim = build(part, options)
+            result = run(part, sim, make_hex(image), preload=3)
+            files = read_volume(run(part, sim, flash=result.flash, eeprom=result.eeprom, dump=DUMP_SECTORS).disk)[1]
+            end = PROG_START + files['PROG_MEM.BIN'][2] if 'USE_TRIM_PROG_MEM' in options else p.prog_end
+            exp = {a: result.flash[a] for a in range(PROG_START, end)}
+            if p.eeprom:
+                exp.update({EEPROM_START + a: result.eeprom[a] for a in range(256)})
+            if part == '47j53': # J parts keep the config words in flash.
+                exp.update({a: result.flash[a] for a in range(0x1FFF8, 0x20000)})
+            else:
+                start, offset, size = config[part]
+                exp.update({start + i: result.config[offset + i] for i in range(size)})
+            path = os.path.join(BUILD_DIR, 'prog_mem.hex')
+            with open(path, 'wb') as f:
+                f.write(files['PROG_MEM.HEX'][3])
+            got = hex_pack.read_hex(path)
+            bad = [f'{a:06X}' for a in sorted(set(got) | set(exp)) if got.get(a) != exp.get(a)]
+            check(not bad, f'{part} {options}: PROG_MEM.HEX differs at {len(bad)} addresses, from {bad[:4]}.')
+
+@test
+def double_buffer():
+    # The queued block is written by boot_tasks() after a random choice of packets, so the next
+    # block can be finished before or after it's written. Shuffled records revisit queued blocks.
+    for part in PARTS:
+        sim = build(part, ['USE_DOUBLE_BUFFER'])
+        image = random_image(part, seed=11)
+        for shuffle in (None, 4):
+            result = run(part, sim, make_hex(image, shuffle=shuffle), preload=3)
+            check_flash(part, result, expected(part, image), f'shuffle {shuffle}')
+
+@test
+def emu_eeprom():
+    # USE_EMU_EEPROM keeps its log in flash. Updates survive each reset, EEPROM.BIN writes go
+    # into the log, and an image with data in the log pages fails.
+    for part, (size, log_start) in EMU_EEPROM.items():
+        sim = build(part, ['USE_EMU_EEPROM'])
+        rng = random.Random(4)
+        model = [0xFF] * size
+        flash = run(part, sim, preload=1).flash
+        for session in range(6): # A reset between each.
+            workload = bytearray()
+            for _ in range(300):
+                addr = rng.randrange(size) if rng.random() < 0.7 else rng.randrange(4)
+                model[addr] = rng.randrange(256)
+                workload += bytes([addr, model[addr]])
+            result = run(part, sim, flash=flash, workload=bytes(workload))
+            check(list(result.eeprom[:size]) == model, f'{part}: EEPROM wrong after session {session}.')
+            flash = result.flash
+        data = bytes(rng.randrange(256) for _ in range(512))
+        result = run(part, sim, data, lba=volume(part, sim, flash)['EEPROM.BIN'][4], flash=flash)
+        check(volume(part, sim, result.flash)['EEPROM.BIN'][3][:size] == data[:size], f'{part}: EEPROM.BIN write lost.')
+        image = random_image(part, size=0x1000, seed=8)
+        image.update(whole_words(part, {log_start + i: 0x12 for i in range(4)}))
+        result = run(part, sim, make_hex(image), preload=2)
+        check_flash(part, result, expected(part, {}), 'image in the EEPROM log', end=log_start)
+
+@test
+def emu_power_cut():
+    # The power is cut at each flash erase and write of an EEPROM workload that compacts the log
+    # a few times. EEPROM reads back as it was before or after the write that was going on. Once
+    # the new page's header is written it's after, though the old page isn't erased yet. Carrying
+    # on from the write that was cut ends with every write in.
+    for part, (size, log_start) in EMU_EEPROM.items():
+        sim = build(part, ['USE_EMU_EEPROM'])
+        page = erase_size(part) * (2 if PARTS[part].pic16 else 1) # EMU_PAGE_SIZE in bytes.
+        rng = random.Random(24)
+        hot = rng.sample(range(size), 6)
+        models = [[0xFF] * size]
+        workload = bytearray()
+        for _ in range(1100 if size == 256 else 150):
+            model = list(models[-1])
+            addr = rng.choice(hot)
+            model[addr] = rng.choice([d for d in range(256) if d != model[addr]])
+            models.append(model)
+            workload += bytes([addr, model[addr]])
+        flash = expected(part, {})
+        headers = 0
+        for n in range(1, 100000):
+            result = run(part, sim, flash=flash, workload=bytes(workload), cut=n)
+            if 'cut' not in result.stats:
+                break
+            done = result['done']
+            got = list(run(part, sim, flash=result.flash, workload=b'').eeprom[:size])
+            what = f'{part} cut at {result["cut"]} after {done} writes'
+            if result['last_op'] == 'word' and result['last_addr'] in (log_start, log_start + page) \
+                    and result['cut'].startswith('erase'):
+                headers += 1
+                check(got == models[done + 1], f'{what}: the compacted page was passed over.')
+            else:
+                check(got in (models[done], models[done + 1]), f'{what}: EEPROM wrong.')
+            resumed = run(part, sim, flash=result.flash, workload=bytes(workload[2 * done:]))
+            check(list(resumed.eeprom[:size]) == models[-1], f'{what}: EEPROM wrong once the workload is done.')
+        check(headers >= 2, f'{part}: only {headers} cuts between a header and erasing the old page.')
+
+@test
+def eeprom_records():
+    # HEX records for EEPROM, shuffled among the flash records, are written once each. A second
+    # copy of the same image writes nothing.
+    for part in ('4550', '14k50'):
+        for options in ([], ['USE_EEPROM_QUEUE']) if part == '4550' else ([],):
+            sim = build(part, options)
+            rng = random.Random(9)
+            flash_image = random_image(part, seed=12)
+            eeprom = {i: rng.randrange(255) for i in range(256) if rng.random() < 0.6}
+            image = dict(flash_image)
+            image.update({EEPROM_START + a: d for a, d in eeprom.items()})
+            text = make_hex(image, rec_len=5, shuffle=2)
+            result = run(part, sim, text)
+            what = f'{part} {" ".join(options)}'
+            check_flash(part, result, expected(part, flash_image), what)
+            check(all(result.eeprom[a] == d for a, d in eeprom.items()), f'{what}: EEPROM data lost.')
+            check(result['ee_writes'] == len(eeprom), f'{what}: {result["ee_writes"]} EEPROM writes for {len(eeprom)} bytes.')
+            check(run(part, sim, text, eeprom=result.eeprom)['ee_writes'] == 0, f'{what}: unchanged bytes rewritten.')
+
+@test
+def eeprom_bin():
+    # EEPROM.BIN reads back what's in EEPROM, and what was just written to it while a queue may
+    # still hold the bytes. PROG_MEM.BIN is read in the same pass, with EEPROM writes pending.
+    option_sets = {'4550': [[], ['USE_EEPROM_MIRROR'], ['USE_EEPROM_QUEUE'], ['USE_EEPROM_MIRROR', 'USE_EEPROM_QUEUE']],
+                   '14k50': [[]]}
+    for part, sets in option_sets.items():
+        rng = random.Random(10)
+        eeprom = bytes(rng.randrange(256) for _ in range(256))
+        data = bytes(rng.randrange(256) for _ in range(512))
+        for options in sets:
+            what = f'{part} {" ".join(options)}'
+            sim = build(part, options)
+            flash = run(part, sim, preload=4).flash
+            files = read_volume(run(part, sim, flash=flash, eeprom=eeprom, dump=DUMP_SECTORS).disk)[1]
+            check(files['EEPROM.BIN'][3][:256] == eeprom, f'{what}: EEPROM.BIN is not EEPROM.')
+            lba = files['EEPROM.BIN'][4]
+            result = run(part, sim, data, lba=lba, flash=flash, eeprom=eeprom, drain=False, dump=DUMP_SECTORS)
+            files = read_volume(result.disk)[1]
+            check(files['EEPROM.BIN'][3][:256] == data[:256], f'{what}: EEPROM.BIN write not read back.')
+            check(files['PROG_MEM.BIN'][3] == bytes(flash[PROG_START:PROG_START + files['PROG_MEM.BIN'][2]]),
+                  f'{what}: PROG_MEM.BIN wrong after an EEPROM.BIN write.')
+            check(run(part, sim, data, lba=lba, flash=flash, eeprom=eeprom).eeprom == data[:256],
+                  f'{what}: EEPROM.BIN write lost.')
+
+@test
+def eeprom_queue():
+    # With USE_EEPROM_QUEUE an image can follow an EEPROM.BIN write in the same session. sim.c
+    # faults if flash is read, erased or written while the queue has an EEPROM write running.
+    part = '4550'
+    for options in (['USE_EEPROM_QUEUE'], ['USE_EEPROM_QUEUE', 'USE_SKIP_SAME'], ['USE_EEPROM_QUEUE', 'USE_UCLZ']):
+        what = f'{part} {" ".join(options)}'
+        sim = build(part, options)
+        flash = run(part, sim, preload=4).flash
+        data = bytes(random.Random(11).randrange(256) for _ in range(512))
+        image = random_image(part, size=3000, seed=3)
+        text = bytes(hex_pack.pack(image, PROG_START, PARTS[part].prog_end)) if 'USE_UCLZ' in options else make_hex(image)
+        lba = volume(part, sim, flash)['EEPROM.BIN'][4]
+        result = run(part, sim, data, lba=lba, flash=flash, second=(text, 0x300))
+        check(all(result.flash[a] == d for a, d in image.items()), f'{what}: image not programmed.')
+        check(result.eeprom == data[:256], f'{what}: EEPROM.BIN write lost.')
+    try:
+        build('14k50', ['USE_EEPROM_QUEUE'])
+        check(False, '14k50: USE_EEPROM_QUEUE builds, the queue does not fit in its RAM.')
+    except SimError as e:
+        check('#error' in str(e), f'14k50: {e}')
+
+def cluster_subst(spc: int, fast_mount: bool = False) -> dict:
+    define = '#define USE_FAST_MOUNT\n' if fast_mount else ''
+    return {'usb_msd_config.h': ('#define SECT_PER_CLUS 1 ', f'{define}#define SECT_PER_CLUS {spc} ')}
+
+@test
+def cluster_size():
+    # Every SECT_PER_CLUS gives the same files, with valid FAT chains and no lost clusters.
+    # PROG_MEM.BIN writes land at its first sector, wherever that cluster is.
+    options = ['USE_PROG_MEM_HEX', 'USE_BIN_WRITE']
+    for part in PARTS:
+        flash = run(part, build(part, options), preload=5).flash
+        base = None
+        for spc in (1, 4, 8, 64):
+            sim = build(part, options, subst=cluster_subst(spc))
+            info, files = read_volume(run(part, sim, flash=flash, dump=4000).disk)
+            what = f'{part} SECT_PER_CLUS {spc}'
+            check(info['spc'] == spc and info['fat_fits'] and not info['lost'], f'{what}: bad volume {info}.')
+            contents = {name: f[3] for name, f in files.items()}
+            base = base or contents
+            check(contents == base, f'{what}: files differ from SECT_PER_CLUS 1.')
+            data = bytes(random.Random(spc).randrange(256) for _ in range(512))
+            exp = expected(part, {PROG_START + i: d & PARTS[part].blank(i) for i, d in enumerate(data)}, flash)
+            check_flash(part, run(part, sim, data, lba=files['PROG_MEM.BIN'][4], flash=flash), exp, f'{what} PROG_MEM.BIN write')
+
+@test
+def fast_mount():
+    # USE_FAST_MOUNT gives a FAT12 volume holding 7 times the largest PROG_MEM.BIN, with the same
+    # files as the FAT16 volume, when read a second time too. The last sector, where a
+    # backup GPT would be, reads as zeros.
+    options = ['USE_PROG_MEM_HEX', 'USE_BIN_WRITE']
+    for part in PARTS:
+        flash = run(part, build(part, options), preload=6).flash
+        files = volume(part, build(part, options), flash)
+        fat16 = {name: f[3] for name, f in files.items()}
+        for spc in (1, 4):
+            sim = build(part, options, subst=cluster_subst(spc, fast_mount=True))
+            what = f'{part} USE_FAST_MOUNT SECT_PER_CLUS {spc}'
+            clusters = -(-7 * files['PROG_MEM.BIN'][2] // (512 * spc)) # 7 times FILE_SIZE.
+            blocks = 2 + (((clusters + 2) * 3 + 1) // 2 + 511) // 512 + clusters * spc
+            disk = run(part, sim, flash=flash, dump=blocks, passes=2).disk
+            info, files = read_volume(disk)
+            check(info['fat12'] and info['fs_type'] == 'FAT12' and info['total'] == blocks, f'{what}: bad volume {info}.')
+            check(info['fat_fits'] and info['signature'] and not info['lost'], f'{what}: bad volume {info}.')
+            check({name: f[3] for name, f in files.items()} == fat16, f'{what}: files differ from FAT16.')
+            check(not any(disk[-512:]), f'{what}: the last sector is not zeros.')
+            data = bytes(random.Random(spc).randrange(256) for _ in range(512))
+            exp = expected(part, {PROG_START + i: d & PARTS[part].blank(i) for i, d in enumerate(data)}, flash)
+            check_flash(part, run(part, sim, data, lba=files['PROG_MEM.BIN'][4], flash=flash), exp, f'{what} PROG_MEM.BIN write')
+
+@test
+def verify():
+    # USE_VERIFY passes shuffled records that write a block twice, retries weak writes until
+    # they're right, and fails an image with a bit that won't program. STATUS.TXT counts both.
+    for part in PARTS:
+        sim = build(part, ['USE_VERIFY'])
+        image = random_image(part, seed=13)
+        for weak in (0, 7):
+            result = run(part, sim, make_hex(image, rec_len=8, shuffle=5), preload=3, dump=DUMP_SECTORS, weak=weak)
+            status = read_volume(result.disk)[1]['STATUS.TXT'][3]
+            check_flash(part, result, expected(part, image), f'weak {weak}')
+            check(b'Write failures: 00000' in status, f'{part} weak {weak}: {status}')
+            check((b'Write retries: 00000' in status) == (weak == 0), f'{part} weak {weak}: {status}')
+        stuck = next(a for a in sorted(image) if a >= PROG_START + 0x100 and not image[a] & 1)
+        result = run(part, sim, make_hex(image), preload=3, dump=DUMP_SECTORS, stuck=stuck)
+        check_flash(part, result, expected(part, {}), 'stuck bit')
+        check(b'Write failures: 00001' in read_volume(result.disk)[1]['STATUS.TXT'][3], f'{part}: stuck bit not counted.')
+
+
+def main():
+    names = sys.argv[1:]
+    failed = 0
+    for func in TESTS:
+        if names and func.__name__ not in names:
+            continue
+        try:
+            func()
+            print(f'PASS {func.__name__}')
+        except Exception as e:
+            failed += 1
+            print(f'FAIL {func.__name__}: {e}')
+    print(f'{failed} failed' if failed else 'All passed')
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
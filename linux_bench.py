@@ -0,0 +1,116 @@
+"""
+This python script mounts the bootloader's drive on Linux and times the mount, listing the
+root directory and reading every file, for each SECT_PER_CLUS and USE_FAST_MOUNT layout. The
+page cache is dropped before each mount, so the drive is read again every time.
+
+With no device, each layout is built with the host sim (see host_test.py), user flash is filled
+with an application, the whole drive is saved as a disk image and the image is loop mounted.
+That times Linux's FAT driver on the layout, the USB transfers and the bootloader's own time
+aren't in it (host_bench.py counts the bootloader's instructions). With a device, the board's
+drive is mounted as it is, as built and programmed.
+
+Prerequisites:
+- Linux with the vfat file system, run as root (mount and drop_caches).
+- For images, gcc and python 3.9 or later, run from a git clone.
+
+Usage:
+    python linux_bench.py [part]     Loop mounts images for part (default 4550).
+    python linux_bench.py /dev/sdX   Mounts a board running the bootloader.
+"""
+
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+from modules.hostsim import PARTS, build, run, read_volume
+
+
+# Constants
+LAYOUTS = [(1, False), (4, False), (8, False), (64, False), (1, True), (4, True)] # SECT_PER_CLUS, USE_FAST_MOUNT.
+OPTIONS = ['USE_PROG_MEM_HEX']
+PASSES = 5 # Each figure is the median of this many mounts.
+
+
+# Drive
+def make_image(part: str, spc: int, fast_mount: bool, path: str):
+    define = '#define USE_FAST_MOUNT\n' if fast_mount else ''
+    subst = {'usb_msd_config.h': ('#define SECT_PER_CLUS 1 ', f'{define}#define SECT_PER_CLUS {spc} ')}
+    sim = build(part, OPTIONS, subst=subst)
+    boot = run(part, sim, preload=6, dump=1).disk
+    total = struct.unpack_from('<H', boot, 19)[0] or struct.unpack_from('<I', boot, 32)[0]
+    disk = run(part, sim, preload=6, dump=total).disk
+    read_volume(disk) # Checks the FAT chains before Linux sees them.
+    with open(path, 'wb') as f:
+        f.write(disk)
+
+def drop_caches():
+    subprocess.run(['sync'], check=True)
+    with open('/proc/sys/vm/drop_caches', 'w') as f:
+        f.write('3\n')
+
+def measure(source: str, loop: bool) -> dict:
+    """ Mounts source read only, lists it, reads every file and unmounts it. Times are in ms. """
+    mount_dir = tempfile.mkdtemp(prefix='usb_uc_')
+    args = ['mount', '-t', 'vfat', '-o', 'ro,loop' if loop else 'ro', source, mount_dir]
+    try:
+        drop_caches()
+        start = time.perf_counter()
+        r = subprocess.run(args, capture_output=True, text=True)
+        mounted = time.perf_counter()
+        if r.returncode:
+            sys.exit(f'mount {source}: {r.stderr.strip()}')
+        try:
+            names = [name for name in sorted(os.listdir(mount_dir)) if os.path.isfile(os.path.join(mount_dir, name))]
+            listed = time.perf_counter()
+            size = 0
+            for name in names:
+                with open(os.path.join(mount_dir, name), 'rb') as f:
+                    size += len(f.read())
+            read = time.perf_counter()
+        finally:
+            subprocess.run(['umount', mount_dir], check=True)
+    finally:
+        os.rmdir(mount_dir)
+    return {'mount': (mounted - start) * 1000, 'list': (listed - mounted) * 1000, 'read': (read - listed) * 1000,
+            'bytes': size}
+
+def median(results: list[dict], name: str) -> float:
+    return sorted(r[name] for r in results)[len(results) // 2]
+
+def row(name: str, source: str, loop: bool) -> list:
+    results = [measure(source, loop) for _ in range(PASSES)]
+    size = results[0]['bytes']
+    read = median(results, 'read')
+    return [name, '%.1f' % median(results, 'mount'), '%.1f' % median(results, 'list'), size, '%.1f' % read,
+            '%.0f' % (size / read) if read else '-']
+
+
+def main():
+    if os.geteuid() != 0:
+        sys.exit('Run as root, mount and drop_caches need it.')
+    arg = sys.argv[1] if len(sys.argv) > 1 else '4550'
+    rows = []
+    if arg.startswith('/dev/'):
+        with open(arg, 'rb') as f:
+            spc = f.read(512)[13]
+        rows.append(row(f'{arg}, SECT_PER_CLUS {spc}', arg, False))
+    else:
+        if arg not in PARTS:
+            sys.exit(f'Unknown part {arg}, one of: {", ".join(PARTS)}.')
+        with tempfile.TemporaryDirectory() as tmp:
+            for spc, fast_mount in LAYOUTS:
+                path = os.path.join(tmp, 'drive.img')
+                make_image(arg, spc, fast_mount, path)
+                name = f'{PARTS[arg].name}, {"FAT12, USE_FAST_MOUNT" if fast_mount else "FAT16"}, SECT_PER_CLUS {spc}'
+                rows.append(row(name, path, True))
+    header = ['Drive', 'Mount (ms)', 'List (ms)', 'Bytes read', 'Read (ms)', 'KB/s']
+    print('| ' + ' | '.join(header) + ' |')
+    print('|' + '|'.join('---' for _ in header) + '|')
+    for r in rows:
+        print('| ' + ' | '.join(str(c) for c in r) + ' |')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,384 @@
+"""
+Host build of the USB_uC bootloader, shared by host_test.py and host_bench.py.
+
+bootloader.c, flash.c and eeprom.c are built with gcc and linked with 'Host Tests/sim.c', which
+stands in for the USB MSD library and for the registers, flash and EEPROM the libraries drive.
+Images are written to it as WRITE_10 packets, and the flash, EEPROM and drive contents come
+back for checking.
+"""
+
+import hashlib
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+
+
+# Constants
+ROOT_DIR = os.path.abspath(os.path.join(os.path.dirname(__file__), '..'))
+SRC_DIR = os.path.join(ROOT_DIR, 'USB_uC.X')
+HOST_DIR = os.path.join(ROOT_DIR, 'Host Tests')
+BUILD_DIR = os.path.join(HOST_DIR, 'build')
+HEX_DIR = os.path.join(ROOT_DIR, 'Hex Files')
+PROG_START = 0x2000
+EEPROM_START = 0xF00000
+CFLAGS = ['-std=gnu99', '-fpack-struct', '-g', '-Wall', '-Wno-unknown-pragmas', '-Wno-error=cpp', '-include', 'stdbool.h']
+
+sys.path.insert(0, ROOT_DIR)
+import hex_pack  # noqa: E402
+
+
+# Data Classes
+class Part:
+    def __init__(self, name: str, defines: list[str], prog_end: int, pic16: bool, eeprom: bool, hex_dir: str):
+        self.name = name
+        self.defines = defines
+        self.prog_end = prog_end  # End of the user program region, as a byte address.
+        self.pic16 = pic16        # 14bit words, the high byte only holds 6 bits.
+        self.eeprom = eeprom
+        self.hex_dir = hex_dir
+
+    def blank(self, addr: int) -> int:
+        return 0x3F if self.pic16 and (addr & 1) else 0xFF
+
+class SimError(Exception):
+    pass
+
+class Result:
+    def __init__(self, part: Part, stats: dict, run_dir: str):
+        self.stats = stats
+        self.flash = _masked(part, _read(run_dir, 'flash.bin'))
+        self.eeprom = _read(run_dir, 'eeprom.bin')
+        self.disk = _read(run_dir, 'disk.bin')
+        self.idle = _masked(part, _read(run_dir, 'idle.bin'))
+        self.config = _read(run_dir, 'config.bin')
+
+    def __getitem__(self, name: str) -> int:
+        return self.stats[name]
+
+
+# Parts
+PARTS = {
+    '4550': Part('PIC18F4550', ['-D_18F4550', '-D_18F4550_FAMILY_', '-D_FLASH_WRITE_SIZE=32', '-D_FLASH_ERASE_SIZE=64'],
+                 0x8000, False, True, 'PIC18FX550'),
+    '14k50': Part('PIC18F14K50', ['-D_18F14K50', '-D_FLASH_WRITE_SIZE=16', '-D_FLASH_ERASE_SIZE=64'],
+                  0x4000, False, True, 'PIC18F14K50'),
+    '47j53': Part('PIC18F47J53', ['-D_18F47J53', '-D__J_PART', '-D_FLASH_WRITE_SIZE=64', '-D_FLASH_ERASE_SIZE=1024'],
+                  0x1FC00, False, False, 'PIC18FX7J53'),
+    '1459': Part('PIC16F1459', ['-D_PIC14E', '-D_16F1459', '-D_FLASH_WRITE_SIZE=32', '-D_FLASH_ERASE_SIZE=32'],
+                 0x4000, True, False, 'PIC16F145X'),
+}
+
+
+# Building
+def _read(run_dir: str, name: str) -> bytes:
+    path = os.path.join(run_dir, name)
+    if not os.path.exists(path):
+        return b''
+    with open(path, 'rb') as f:
+        return f.read()
+
+def _masked(part: Part, data: bytes) -> bytearray:
+    data = bytearray(data)
+    if part.pic16:
+        for i in range(1, len(data), 2):
+            data[i] &= 0x3F
+    return data
+
+def _git(*args: str) -> bytes:
+    return subprocess.run(['git', *args], cwd=ROOT_DIR, check=True, capture_output=True).stdout
+
+def request_rev(request_id: str) -> str:
+    """ Returns the commit that implemented a request (not its later fixes). """
+    for line in _git('log', '--format=%H %s').decode().splitlines():
+        rev, subject = line.split(' ', 1)
+        if subject.startswith(f'[{request_id}] ') and not subject.startswith(f'[{request_id}] fix:'):
+            return rev
+    raise SimError(f'No commit for {request_id}.')
+
+def sources(rev: str = None, subst: dict[str, tuple[str, str]] = None) -> str:
+    """
+    Returns a directory holding the bootloader sources. That's USB_uC.X itself, unless a git
+    revision is asked for or a file needs a substitution, {file: (old, new)}, such as a
+    different SECT_PER_CLUS in usb_msd_config.h.
+    """
+    if rev is None and not subst:
+        return SRC_DIR
+    key = hashlib.sha1(repr((rev, sorted((subst or {}).items()))).encode()).hexdigest()[:12]
+    out_dir = os.path.join(BUILD_DIR, 'src-' + key)
+    if rev is None:
+        names = [n for n in os.listdir(SRC_DIR) if n.endswith(('.c', '.h'))]
+    else:
+        names = [os.path.basename(n) for n in _git('ls-tree', '--name-only', rev, 'USB_uC.X/').decode().splitlines()
+                 if n.endswith(('.c', '.h'))]
+    os.makedirs(out_dir, exist_ok=True)
+    for name in names:
+        if rev is None:
+            with open(os.path.join(SRC_DIR, name), 'rb') as f:
+                text = f.read().decode('utf-8')
+        else:
+            text = _git('show', f'{rev}:USB_uC.X/{name}').decode('utf-8')
+        if subst and name in subst:
+            old, new = subst[name]
+            if old not in text:
+                raise SimError(f'{name}: "{old}" not found.')
+            text = text.replace(old, new)
+        with open(os.path.join(out_dir, name), 'w', encoding='utf-8', newline='') as f:
+            f.write(text)
+        if name == 'EEPROM.h':  # Included as "eeprom.h".
+            shutil.copy(os.path.join(out_dir, name), os.path.join(out_dir, 'eeprom.h'))
+    return out_dir
+
+_built = {}
+
+def build(part: str, options: list[str] = (), rev: str = None, subst: dict = None, opt: str = '-O0') -> str:
+    """
+    Builds the sim for a part with bootloader options (['USE_VERIFY', ...]) and returns its path.
+    The current sources have to build without warnings, older revisions only have to build.
+    """
+    key = repr((part, sorted(options), rev, sorted((subst or {}).items()), opt))
+    if key in _built:
+        return _built[key]
+    src = sources(rev, subst)
+    os.makedirs(BUILD_DIR, exist_ok=True)
+    out = os.path.join(BUILD_DIR, 'sim-' + part + '-' + hashlib.sha1(key.encode()).hexdigest()[:12])
+    files = [os.path.join(HOST_DIR, 'sim.c')] + [os.path.join(src, n) for n in ('bootloader.c', 'flash.c', 'eeprom.c')]
+    cmd = ['gcc', *CFLAGS, *(['-Werror'] if rev is None else []), opt, '-I', src, '-I', os.path.join(HOST_DIR, 'inc'),
+           *PARTS[part].defines, *['-D' + o + ('' if '=' in o else '=') for o in options], '-o', out, *files]
+    r = subprocess.run(cmd, capture_output=True, text=True)
+    if r.returncode:
+        raise SimError(f'Build failed: {part} {" ".join(options)}\n{r.stderr[-3000:]}')
+    _built[key] = out
+    return out
+
+def icount_path() -> str:
+    out = os.path.join(BUILD_DIR, 'icount')
+    if 'icount' not in _built:
+        os.makedirs(BUILD_DIR, exist_ok=True)
+        subprocess.run(['gcc', '-O2', '-o', out, os.path.join(HOST_DIR, 'icount.c')], check=True)
+        _built['icount'] = out
+    return out
+
+
+# Running
+def run(part: str, sim: str, image: bytes = b'', lba: int = 0x200, preload: int = 0, flash: bytes = None,
+        eeprom: bytes = None, second: tuple[bytes, int] = None, idle: int = None, drain: bool = True,
+        dump: int = 0, passes: int = 1, workload: bytes = None, ranges: bytes = None, weak: int = 0,
+        stuck: int = None, cut: int = None, count: str = None, timing: tuple = None) -> Result:
+    """ Runs a sim build, the options are those of sim.c. Raises SimError if the sim faults. """
+    run_dir = os.path.join(BUILD_DIR, 'run')
+    shutil.rmtree(run_dir, ignore_errors=True)
+    os.makedirs(run_dir)
+    args = [sim, '-l', str(lba)]
+
+    def put(name, data):
+        with open(os.path.join(run_dir, name), 'wb') as f:
+            f.write(data.encode() if isinstance(data, str) else data)
+        return name
+
+    if preload:
+        args += ['-p', str(preload)]
+    if flash is not None:
+        args += ['-f', put('flash_in.bin', bytes(flash))]
+    if eeprom is not None:
+        args += ['-e', put('eeprom_in.bin', bytes(eeprom))]
+    if second is not None:
+        args += ['-2', put('second.img', second[0]) + '@' + str(second[1])]
+    if idle is not None:
+        args += ['-i', str(idle)]
+    if not drain:
+        args += ['-n']
+    if dump:
+        args += ['-d', str(dump), '-a', str(passes)]
+    if workload is not None:
+        args += ['-r', put('workload.bin', workload)]
+    if ranges is not None:
+        args += ['-g', put('ranges.bin', ranges)]
+    if weak:
+        args += ['-w', str(weak)]
+    if stuck is not None:
+        args += ['-b', str(stuck)]
+    if cut is not None:
+        args += ['-c', str(cut)]
+    if count:
+        args = [icount_path()] + args + ['-k', count]
+    if timing:
+        args += ['-t', ','.join(str(t) for t in timing)]
+    if workload is None and ranges is None:
+        args.append(put('image.img', image))
+    r = subprocess.run(args, cwd=run_dir, capture_output=True, text=True)
+    stats = {}
+    for line in (r.stdout + r.stderr).splitlines():
+        if '=' in line:
+            name, value = line.split('=', 1)
+            try:
+                stats[name] = float(value) if '.' in value else int(value)
+            except ValueError:
+                stats[name] = value
+    if r.returncode or 'fail' in stats:
+        raise SimError(stats.get('fail', r.stdout + r.stderr))
+    return Result(PARTS[part], stats, run_dir)
+
+
+# Images
+def make_hex(image: dict[int, int], rec_len: int = 16, shuffle: int = None, eof: bool = True) -> str:
+    """ Returns Intel HEX for {address: byte}. shuffle is a seed for putting records out of order. """
+    addrs = sorted(image)
+    records = []
+    i = 0
+    while i < len(addrs):
+        start = addrs[i]
+        data = [image[start]]
+        i += 1
+        while (i < len(addrs) and addrs[i] == start + len(data) and len(data) < rec_len
+               and (addrs[i] & 0xFFFF) != 0):
+            data.append(image[addrs[i]])
+            i += 1
+        records.append((start, data))
+    if shuffle is not None:
+        random.Random(shuffle).shuffle(records)
+    lines = []
+    upper = None
+    for start, data in records:
+        if start >> 16 != upper:
+            upper = start >> 16
+            lines.append(hex_record(0, 4, [upper >> 8, upper & 0xFF]))
+        lines.append(hex_record(start & 0xFFFF, 0, data))
+    if eof:
+        lines.append(':00000001FF\r\n')
+    return ''.join(lines)
+
+def hex_record(offset: int, rec_type: int, data: list[int]) -> str:
+    rec = [len(data), offset >> 8, offset & 0xFF, rec_type] + list(data)
+    return ':' + ''.join('%02X' % b for b in rec) + '%02X\r\n' % (-sum(rec) & 0xFF)
+
+def make_uf2(image: dict[int, int], family: int = None, payload: int = 256) -> bytes:
+    """ Returns a UF2 file for {address: byte}, one block per payload sized run. family sets
+        UF2_FLAG_FAMILY_ID. Gaps inside a block are filled with 0xFF. """
+    starts = sorted({addr - addr % payload for addr in image})
+    blocks = bytearray()
+    for n, start in enumerate(starts):
+        data = bytes(image.get(start + i, 0xFF) for i in range(payload))
+        flags = 0x2000 if family is not None else 0
+        header = struct.pack('<8I', 0x0A324655, 0x9E5D5157, flags, start, payload, n, len(starts), family or 0)
+        blocks += header + data.ljust(476, b'\0') + struct.pack('<I', 0x0AB16F30)
+    return bytes(blocks)
+
+def random_image(part: str, size: int = None, seed: int = 1, gaps: bool = True) -> dict[int, int]:
+    """ Random runs of data with gaps between them, from PROG_START. """
+    rng = random.Random(seed)
+    p = PARTS[part]
+    end = PROG_START + size if size else p.prog_end
+    image = {}
+    addr = PROG_START
+    while addr < end:
+        if gaps and rng.random() < 0.3:
+            addr += rng.randint(1, 200)
+            continue
+        for _ in range(rng.randint(1, 300)):
+            if addr >= end:
+                break
+            image[addr] = rng.randint(0, 255) & (0x3F if p.pic16 and addr & 1 else 0xFF)
+            addr += 1
+    return whole_words(part, image)
+
+def whole_words(part: str, image: dict[int, int]) -> dict[int, int]:
+    """ PIC16 images hold whole words, as a compiler's do. """
+    if PARTS[part].pic16:
+        for addr in list(image):
+            image.setdefault(addr ^ 1, PARTS[part].blank(addr ^ 1))
+    return image
+
+def expected(part: str, image: dict[int, int], base: bytes = None) -> bytearray:
+    """ Flash after programming image over base (blank if None). """
+    p = PARTS[part]
+    flash = bytearray(base) if base is not None else bytearray(p.blank(a) for a in range(0x20000))
+    for addr, data in image.items():
+        if PROG_START <= addr < p.prog_end:
+            flash[addr] = data
+    return flash
+
+def mismatch(flash: bytes, exp: bytes, start: int = PROG_START, end: int = 0x20000) -> str:
+    """ Returns where flash first differs from exp, or '' if it doesn't. """
+    for addr in range(start, end):
+        if flash[addr] != exp[addr]:
+            return 'mismatch at 0x%05X: 0x%02X, expected 0x%02X' % (addr, flash[addr], exp[addr])
+    return ''
+
+def real_hexes(part: str) -> list[tuple[str, dict[int, int], str]]:
+    """
+    Real compiler output for a part as (name, {address: byte}, HEX text): the test
+    applications from 'Hex Files' as they are, and the bootloader images moved up to
+    PROG_START so they can be programmed as applications. Only the user program region is
+    kept in the image, the test applications' config and ID records are left in the text.
+    """
+    p = PARTS[part]
+    folder = os.path.join(HEX_DIR, p.hex_dir)
+    out = []
+    for name in sorted(os.listdir(folder)):
+        if not name.endswith('.hex'):
+            continue
+        path = os.path.join(folder, name)
+        image = hex_pack.read_hex(path)
+        if name.startswith('Test_'):
+            with open(path, 'r') as f:
+                text = f.read()
+            image = {a: d for a, d in image.items() if PROG_START <= a < p.prog_end}
+        else:
+            image = {a + PROG_START: d for a, d in image.items() if a < PROG_START}
+            text = make_hex(image)
+        out.append((name, image, text))
+    return out
+
+
+# Volume
+def read_volume(disk: bytes) -> tuple[dict, dict]:
+    """
+    Reads a FAT12/FAT16 volume dump. Returns the geometry and {name: (attributes, cluster,
+    size, data, lba)}. FAT chains are checked as they're followed.
+    """
+    bps, spc, rsv, n_fats, root_ents, tot16, _, fat_size = struct.unpack_from('<HBHBHHBH', disk, 11)
+    total = tot16 or struct.unpack_from('<I', disk, 32)[0]
+    root_lba = rsv + n_fats * fat_size
+    data_lba = root_lba + (root_ents * 32 + bps - 1) // bps
+    clusters = (total - data_lba) // spc
+    fat12 = clusters < 4085
+    fat = disk[rsv * bps:(rsv + fat_size) * bps]
+
+    def entry(c):
+        if fat12:
+            v = struct.unpack_from('<H', fat, c * 3 // 2)[0]
+            v = v >> 4 if c & 1 else v & 0xFFF
+            return v | 0xF000 if v >= 0xFF8 else v
+        return struct.unpack_from('<H', fat, c * 2)[0]
+
+    need = ((clusters + 2) * 3 + 1) // 2 if fat12 else (clusters + 2) * 2
+    info = dict(spc=spc, total=total, fat_size=fat_size, clusters=clusters, fat12=fat12,
+                fs_type=disk[54:62].decode().strip(), fat_fits=need <= fat_size * bps,
+                signature=disk[510:512] == b'\x55\xAA', root_lba=root_lba, data_lba=data_lba)
+    files = {}
+    used = set()
+    for i in range(root_ents):
+        e = disk[root_lba * bps + i * 32:root_lba * bps + i * 32 + 32]
+        if len(e) < 32 or e[0] == 0:
+            break
+        if e[0] == 0xE5 or e[11] & 0x08:
+            continue
+        name = e[:8].decode().strip() + '.' + e[8:11].decode().strip()
+        first, size = struct.unpack_from('<H', e, 26)[0], struct.unpack_from('<I', e, 28)[0]
+        data = b''
+        c = first
+        while c and c < 0xFFF8:
+            if not 2 <= c < clusters + 2 or c in used:
+                raise SimError(f'{name}: bad cluster {c}.')
+            used.add(c)
+            off = (data_lba + (c - 2) * spc) * bps
+            data += disk[off:off + spc * bps]
+            c = entry(c)
+        if len(data) != (size + spc * bps - 1) // (spc * bps) * spc * bps:
+            raise SimError(f'{name}: chain doesn\'t match the size.')
+        files[name] = (e[11], first, size, data[:size], data_lba + (first - 2) * spc)
+    info['lost'] = [c for c in range(2, clusters + 2) if entry(c) and c not in used]
+    return info, files